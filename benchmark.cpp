@@ -0,0 +1,117 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_RIGHT_HANDED
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "jobs.hpp"
+#include "transform.hpp"
+
+struct NaiveNode
+{
+	glm::mat4 local;
+	glm::mat4 world;
+	std::vector<uint32_t> children;
+};
+
+void updateNaive(std::vector<NaiveNode>& nodes, uint32_t node, const glm::mat4& parent)
+{
+	nodes.at(node).world = parent * nodes.at(node).local;
+	for (auto child : nodes.at(node).children)
+		updateNaive(nodes, child, nodes.at(node).world);
+}
+
+template<typename Function>
+double measure(uint32_t iterations, Function function)
+{
+	auto startTime = std::chrono::high_resolution_clock::now();
+	for (uint32_t i = 0; i < iterations; i++)
+		function();
+	auto currentTime = std::chrono::high_resolution_clock::now();
+
+	return std::chrono::duration<double, std::milli>(currentTime - startTime).count() / iterations;
+}
+
+int main(int argc, char** argv)
+{
+	uint32_t nodeCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 50000;
+	uint32_t iterations = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 100;
+
+	std::mt19937 generator(1);
+	std::uniform_real_distribution<float> distribution(-1.0f, 1.0f);
+
+	TransformHierarchy hierarchy;
+	std::vector<NaiveNode> nodes(nodeCount);
+	std::vector<uint32_t> roots;
+
+	// Trees of a thousand nodes, each node hangs off one of the few most recent ones in its tree,
+	// giving deep and bushy hierarchies like glTF scenes
+	for (uint32_t i = 0; i < nodeCount; i++)
+	{
+		auto local = glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(distribution(generator),
+			distribution(generator), distribution(generator))), distribution(generator), glm::vec3(0.0f, 0.0f, 1.0f));
+		auto parent = i % 1000 == 0 ? rootTransform : i - 1 - generator() % std::min(i % 1000, 8u);
+
+		addTransform(hierarchy, parent, local);
+		nodes.at(i).local = local;
+		if (parent == rootTransform)
+			roots.push_back(i);
+		else
+			nodes.at(parent).children.push_back(i);
+	}
+
+	auto naiveTime = measure(iterations, [&]() {
+		for (auto root : roots)
+			updateNaive(nodes, root, glm::mat4(1.0f));
+	});
+
+	auto fullTime = measure(iterations, [&]() {
+		std::fill(hierarchy.dirty.begin(), hierarchy.dirty.end(), 1);
+		updateTransforms(hierarchy);
+	});
+
+	float error = 0.0f;
+	for (uint32_t i = 0; i < nodeCount; i++)
+		for (uint32_t j = 0; j < 4; j++)
+			for (uint32_t k = 0; k < 4; k++)
+				error = std::max(error, std::abs(nodes.at(i).world[j][k] - getTransform(hierarchy, i)[j][k]) /
+					std::max(1.0f, std::abs(nodes.at(i).world[j][k])));
+
+	auto partialTime = measure(iterations, [&]() {
+		// Nodes near the end of each tree, so the dirty subtrees stay small
+		for (uint32_t i = 990; i < nodeCount; i += 1000)
+			for (uint32_t j = i; j < std::min(i + 10, nodeCount); j++)
+				setTransform(hierarchy, j, getLocalTransform(hierarchy, j));
+		updateTransforms(hierarchy);
+	});
+
+	auto staticTime = measure(iterations, [&]() {
+		updateTransforms(hierarchy);
+	});
+
+	JobSystem jobs;
+	startJobSystem(jobs, std::max(std::thread::hardware_concurrency(), 2u) - 1);
+	auto parallelTime = measure(iterations, [&]() {
+		std::fill(hierarchy.dirty.begin(), hierarchy.dirty.end(), 1);
+		updateTransforms(hierarchy, [&jobs](uint32_t begin, uint32_t end, const auto& function) {
+			parallelFor(jobs, begin, end, 1024, function);
+		});
+	});
+	stopJobSystem(jobs);
+
+	std::cout << "Nodes:            " << nodeCount << '\n'
+		<< "Naive recursion:  " << naiveTime << " ms\n"
+		<< "Flat, all dirty:  " << fullTime << " ms\n"
+		<< "Flat, 1% dirty:   " << partialTime << " ms\n"
+		<< "Flat, unchanged:  " << staticTime << " ms\n"
+		<< "Flat, " << jobs.workerCount + 1 << " threads: " << parallelTime << " ms\n"
+		<< "Relative error:   " << error << std::endl;
+
+	return error < 1e-3f ? EXIT_SUCCESS : EXIT_FAILURE;
+}
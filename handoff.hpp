@@ -0,0 +1,96 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+
+// Double-buffered hand-off between one producer and one consumer. The producer fills one slot while the
+// consumer reads the other, but never publishes a second value before the consumer has taken the first,
+// so what the consumer reads is at most one step old. Ownership moves by the counters alone, the mutex
+// only parks a side that has to wait and is never held while a slot is touched
+template<typename Value>
+struct Handoff
+{
+	std::array<Value, 2> slots;
+	std::atomic<uint64_t> published;
+	std::atomic<uint64_t> acquired;
+	std::atomic<uint64_t> released;
+	std::atomic<bool> closed;
+	std::mutex mutex;
+	std::condition_variable signal;
+};
+
+template<typename Value>
+void openHandoff(Handoff<Value>& handoff)
+{
+	handoff.published = 0;
+	handoff.acquired = 0;
+	handoff.released = 0;
+	handoff.closed = false;
+}
+
+template<typename Value, typename Predicate>
+void waitHandoff(Handoff<Value>& handoff, Predicate predicate)
+{
+	if (predicate())
+		return;
+
+	std::unique_lock<std::mutex> lock(handoff.mutex);
+	handoff.signal.wait(lock, [&]() { return predicate() || handoff.closed.load(); });
+}
+
+template<typename Value>
+void notifyHandoff(Handoff<Value>& handoff)
+{
+	{
+		std::lock_guard<std::mutex> lock(handoff.mutex);
+	}
+	handoff.signal.notify_all();
+}
+
+// Null once the hand-off is closed, otherwise the slot not being read. Waits until the consumer has taken
+// the last published value, by then it is done with the slot written before that
+template<typename Value>
+Value* beginWrite(Handoff<Value>& handoff)
+{
+	auto published = handoff.published.load(std::memory_order_relaxed);
+	waitHandoff(handoff, [&]() { return handoff.acquired.load(std::memory_order_acquire) == published; });
+
+	return handoff.closed ? nullptr : &handoff.slots.at(published % 2);
+}
+
+template<typename Value>
+void endWrite(Handoff<Value>& handoff)
+{
+	handoff.published.fetch_add(1, std::memory_order_release);
+	notifyHandoff(handoff);
+}
+
+// Null once the hand-off is closed, otherwise the published slot not yet read
+template<typename Value>
+const Value* beginRead(Handoff<Value>& handoff)
+{
+	auto released = handoff.released.load(std::memory_order_relaxed);
+	waitHandoff(handoff, [&]() { return handoff.published.load(std::memory_order_acquire) > released; });
+	if (handoff.closed)
+		return nullptr;
+
+	handoff.acquired.store(released + 1, std::memory_order_release);
+	notifyHandoff(handoff);
+	return &handoff.slots.at(released % 2);
+}
+
+template<typename Value>
+void endRead(Handoff<Value>& handoff)
+{
+	handoff.released.fetch_add(1, std::memory_order_relaxed);
+}
+
+template<typename Value>
+void closeHandoff(Handoff<Value>& handoff)
+{
+	handoff.closed = true;
+	notifyHandoff(handoff);
+}
@@ -0,0 +1,236 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+// Jobs waited on together, a job counts until it has finished running. The first exception thrown by one
+// of them is kept for whoever waits on the group
+struct JobGroup
+{
+	std::atomic<uint32_t> counter{ 0 };
+	std::mutex errorMutex;
+	std::exception_ptr error;
+};
+
+struct Job
+{
+	std::function<void()> function;
+	JobGroup* group;
+};
+
+struct JobQueue
+{
+	std::mutex mutex;
+	std::deque<Job> jobs;
+};
+
+// Written only by the thread owning the slot, read once the system has stopped
+struct JobStats
+{
+	uint64_t jobs;
+	uint64_t steals;
+	std::chrono::steady_clock::duration busy;
+};
+
+// Work-stealing scheduler, one queue per worker followed by one per caller thread. Owners take their newest
+// job while thieves take the oldest, which is usually the biggest piece of a split range
+struct JobSystem
+{
+	uint32_t workerCount;
+	std::vector<std::unique_ptr<JobQueue>> queues;
+	std::vector<JobStats> stats;
+	std::vector<std::thread> workers;
+	std::atomic<uint32_t> queued;
+	std::mutex sleepMutex;
+	std::condition_variable wake;
+	bool running;
+	std::chrono::steady_clock::time_point startTime;
+};
+
+inline thread_local uint32_t jobSlot = std::numeric_limits<uint32_t>::max();
+
+// Threads that never registered as a caller share the first caller slot
+inline uint32_t getJobSlot(const JobSystem& system)
+{
+	return jobSlot < system.queues.size() ? jobSlot : system.workerCount;
+}
+
+inline void setJobCaller(JobSystem& system, uint32_t caller)
+{
+	jobSlot = system.workerCount + caller;
+}
+
+inline bool takeJob(JobSystem& system, uint32_t slot, Job& job)
+{
+	for (uint32_t i = 0; i < system.queues.size(); i++)
+	{
+		auto& queue = *system.queues.at((slot + i) % system.queues.size());
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		if (queue.jobs.empty())
+			continue;
+
+		if (i == 0)
+		{
+			job = std::move(queue.jobs.back());
+			queue.jobs.pop_back();
+		}
+		else
+		{
+			job = std::move(queue.jobs.front());
+			queue.jobs.pop_front();
+			system.stats.at(slot).steals++;
+		}
+		system.queued--;
+		return true;
+	}
+
+	return false;
+}
+
+inline void executeJob(JobSystem& system, uint32_t slot, Job& job)
+{
+	auto startTime = std::chrono::steady_clock::now();
+	try {
+		job.function();
+	}
+	catch (...) {
+		std::lock_guard<std::mutex> lock(job.group->errorMutex);
+		if (!job.group->error)
+			job.group->error = std::current_exception();
+	}
+
+	auto& stats = system.stats.at(slot);
+	stats.busy += std::chrono::steady_clock::now() - startTime;
+	stats.jobs++;
+	job.group->counter.fetch_sub(1, std::memory_order_release);
+}
+
+inline void runJob(JobSystem& system, JobGroup& group, std::function<void()> function)
+{
+	group.counter++;
+	system.queued++;
+
+	auto& queue = *system.queues.at(getJobSlot(system));
+	{
+		std::lock_guard<std::mutex> lock(queue.mutex);
+		queue.jobs.push_back(Job{
+			std::move(function),
+			&group
+		});
+	}
+
+	// Taking the lock orders this against a worker that just found nothing queued and is about to sleep
+	{
+		std::lock_guard<std::mutex> lock(system.sleepMutex);
+	}
+	system.wake.notify_one();
+}
+
+// Waiting threads run queued jobs instead of blocking, so nested waits cannot starve the pool. Only the
+// group's own exception is rethrown, failures of unrelated jobs run meanwhile stay with their groups
+inline void waitJobs(JobSystem& system, JobGroup& group)
+{
+	auto slot = getJobSlot(system);
+	Job job;
+
+	while (group.counter.load(std::memory_order_acquire))
+	{
+		if (takeJob(system, slot, job))
+			executeJob(system, slot, job);
+		else
+			std::this_thread::yield();
+	}
+
+	std::lock_guard<std::mutex> lock(group.errorMutex);
+	if (group.error)
+		std::rethrow_exception(std::exchange(group.error, nullptr));
+}
+
+inline void runJobWorker(JobSystem& system, uint32_t slot)
+{
+	jobSlot = slot;
+	Job job;
+
+	while (true)
+	{
+		if (takeJob(system, slot, job))
+		{
+			executeJob(system, slot, job);
+			continue;
+		}
+
+		std::unique_lock<std::mutex> lock(system.sleepMutex);
+		system.wake.wait(lock, [&system]() { return system.queued.load() || !system.running; });
+		if (!system.running && !system.queued.load())
+			return;
+	}
+}
+
+inline void startJobSystem(JobSystem& system, uint32_t workerCount, uint32_t callerCount = 1)
+{
+	system.workerCount = workerCount;
+	for (uint32_t i = 0; i < workerCount + callerCount; i++)
+		system.queues.push_back(std::make_unique<JobQueue>());
+	system.stats.assign(workerCount + callerCount, JobStats{});
+	system.queued = 0;
+	system.running = true;
+	system.startTime = std::chrono::steady_clock::now();
+
+	for (uint32_t i = 0; i < workerCount; i++)
+		system.workers.emplace_back(runJobWorker, std::ref(system), i);
+}
+
+// Workers drain whatever is still queued before they exit
+inline void stopJobSystem(JobSystem& system)
+{
+	{
+		std::lock_guard<std::mutex> lock(system.sleepMutex);
+		system.running = false;
+	}
+	system.wake.notify_all();
+
+	for (auto& worker : system.workers)
+		worker.join();
+	system.workers.clear();
+}
+
+// Splits [begin, end) into chunks of at most grain items handed to function(first, last). The caller
+// runs the first chunk itself and helps with the rest while it waits
+template<typename Function>
+void parallelFor(JobSystem& system, uint32_t begin, uint32_t end, uint32_t grain, const Function& function)
+{
+	if (end - begin <= grain || !system.workerCount)
+	{
+		if (begin < end)
+			function(begin, end);
+		return;
+	}
+
+	JobGroup group;
+	for (auto first = begin + grain; first < end; first += std::min(grain, end - first))
+	{
+		auto last = first + std::min(grain, end - first);
+		runJob(system, group, [&function, first, last]() { function(first, last); });
+	}
+
+	try {
+		function(begin, begin + grain);
+	}
+	catch (...) {
+		waitJobs(system, group);
+		throw;
+	}
+	waitJobs(system, group);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+// Window, device and every per-frame resource, configured from the TRIANGLE_* environment switches
+void setup();
+
+// Renders until the window closes or TRIANGLE_FRAMES frames have been submitted
+void draw();
+
+// Waits for the device and releases everything setup created
+void clean();
@@ -0,0 +1,650 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <fstream>
+#include <iterator>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "headers/json.hpp"
+#include "transform.hpp"
+
+struct Vertex
+{
+	glm::vec3 pos;
+	glm::vec3 col;
+	glm::vec2 tex;
+};
+
+// Zero frames in flight and frame rate leave the choice to the present policy
+struct SceneSettings
+{
+	uint32_t width;
+	uint32_t height;
+	uint32_t framesInFlight;
+	uint32_t samples;
+	std::string present;
+	double frameRate;
+	uint64_t frames;
+	std::string shaders;
+};
+
+// Range of the scene's shared vertex and index arrays, indices are relative to the first vertex
+struct SceneMesh
+{
+	uint32_t firstVertex;
+	uint32_t vertexCount;
+	uint32_t firstIndex;
+	uint32_t indexCount;
+};
+
+// Rotation is in degrees around x, y and z, parent is an earlier instance or rootTransform
+struct SceneInstance
+{
+	uint32_t mesh;
+	uint32_t parent;
+	glm::vec3 translation;
+	glm::vec3 rotation;
+	glm::vec3 scale;
+	glm::vec3 color;
+};
+
+struct CameraKey
+{
+	float time;
+	glm::vec3 eye;
+	glm::vec3 target;
+};
+
+// Everything read from a config file, kept in flat arrays so loading never builds a document tree
+struct Scene
+{
+	SceneSettings settings;
+	float spin;
+	std::vector<Vertex> vertices;
+	std::vector<uint32_t> indices;
+	std::vector<SceneMesh> meshes;
+	std::vector<SceneInstance> instances;
+	float fieldOfView;
+	float nearPlane;
+	float farPlane;
+	glm::vec3 up;
+	std::vector<CameraKey> cameraPath;
+};
+
+// The textured quad the renderer shows without a config
+inline Scene getDefaultScene()
+{
+	Scene scene{
+		SceneSettings{
+			800,
+			600,
+			0,
+			4,
+			"balanced",
+			0.0,
+			0,
+			"shaders"
+		},
+		90.0f,
+		{
+			Vertex{ {-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f}, {0.0f, 0.0f} },
+			Vertex{ { 0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f}, {1.0f, 0.0f} },
+			Vertex{ {-0.5f,  0.5f, 0.0f}, {0.0f, 0.0f, 1.0f}, {0.0f, 1.0f} },
+			Vertex{ { 0.5f,  0.5f, 0.0f}, {0.0f, 0.0f, 0.0f}, {1.0f, 1.0f} }
+		},
+		{ 0, 1, 2, 1, 3, 2 },
+		{ SceneMesh{ 0, 4, 0, 6 } },
+		{},
+		45.0f,
+		0.1f,
+		10.0f,
+		glm::vec3(0.0f, 0.0f, -1.0f),
+		{ CameraKey{ 0.0f, glm::vec3(-2.0f, -2.0f, -2.0f), glm::vec3(0.0f) } }
+	};
+
+	return scene;
+}
+
+// Every value the parser knows where to put, array containers are followed by the field of their elements
+enum class SceneField
+{
+	eNone,
+	eRoot,
+	eSettings,
+	eWidth,
+	eHeight,
+	eFramesInFlight,
+	eSamples,
+	ePresent,
+	eFrameRate,
+	eFrames,
+	eShaders,
+	eScene,
+	eSpin,
+	eMeshList,
+	eMesh,
+	eMeshName,
+	ePositionList,
+	ePosition,
+	eColorList,
+	eColor,
+	eTexcoordList,
+	eTexcoord,
+	eIndexList,
+	eIndex,
+	eInstanceList,
+	eInstance,
+	eInstanceMesh,
+	eInstanceParent,
+	eTranslationList,
+	eTranslation,
+	eRotationList,
+	eRotation,
+	eScaleList,
+	eScale,
+	eInstanceColorList,
+	eInstanceColor,
+	eCamera,
+	eFieldOfView,
+	eNearPlane,
+	eFarPlane,
+	eUpList,
+	eUp,
+	ePathList,
+	eCameraKey,
+	eKeyTime,
+	eEyeList,
+	eEye,
+	eTargetList,
+	eTarget
+};
+
+// Field a key opens inside its parent, array elements are looked up with the key []
+inline SceneField resolveField(SceneField parent, const std::string& key)
+{
+	struct SceneKey
+	{
+		SceneField parent;
+		const char* key;
+		SceneField field;
+	};
+
+	static const SceneKey keys[] = {
+		{ SceneField::eRoot, "settings", SceneField::eSettings },
+		{ SceneField::eRoot, "scene", SceneField::eScene },
+		{ SceneField::eSettings, "width", SceneField::eWidth },
+		{ SceneField::eSettings, "height", SceneField::eHeight },
+		{ SceneField::eSettings, "framesInFlight", SceneField::eFramesInFlight },
+		{ SceneField::eSettings, "samples", SceneField::eSamples },
+		{ SceneField::eSettings, "present", SceneField::ePresent },
+		{ SceneField::eSettings, "frameRate", SceneField::eFrameRate },
+		{ SceneField::eSettings, "frames", SceneField::eFrames },
+		{ SceneField::eSettings, "shaders", SceneField::eShaders },
+		{ SceneField::eScene, "spin", SceneField::eSpin },
+		{ SceneField::eScene, "meshes", SceneField::eMeshList },
+		{ SceneField::eScene, "instances", SceneField::eInstanceList },
+		{ SceneField::eScene, "camera", SceneField::eCamera },
+		{ SceneField::eMeshList, "[]", SceneField::eMesh },
+		{ SceneField::eMesh, "name", SceneField::eMeshName },
+		{ SceneField::eMesh, "positions", SceneField::ePositionList },
+		{ SceneField::eMesh, "colors", SceneField::eColorList },
+		{ SceneField::eMesh, "texcoords", SceneField::eTexcoordList },
+		{ SceneField::eMesh, "indices", SceneField::eIndexList },
+		{ SceneField::ePositionList, "[]", SceneField::ePosition },
+		{ SceneField::eColorList, "[]", SceneField::eColor },
+		{ SceneField::eTexcoordList, "[]", SceneField::eTexcoord },
+		{ SceneField::eIndexList, "[]", SceneField::eIndex },
+		{ SceneField::eInstanceList, "[]", SceneField::eInstance },
+		{ SceneField::eInstance, "mesh", SceneField::eInstanceMesh },
+		{ SceneField::eInstance, "parent", SceneField::eInstanceParent },
+		{ SceneField::eInstance, "translation", SceneField::eTranslationList },
+		{ SceneField::eInstance, "rotation", SceneField::eRotationList },
+		{ SceneField::eInstance, "scale", SceneField::eScaleList },
+		{ SceneField::eInstance, "color", SceneField::eInstanceColorList },
+		{ SceneField::eTranslationList, "[]", SceneField::eTranslation },
+		{ SceneField::eRotationList, "[]", SceneField::eRotation },
+		{ SceneField::eScaleList, "[]", SceneField::eScale },
+		{ SceneField::eInstanceColorList, "[]", SceneField::eInstanceColor },
+		{ SceneField::eCamera, "fov", SceneField::eFieldOfView },
+		{ SceneField::eCamera, "near", SceneField::eNearPlane },
+		{ SceneField::eCamera, "far", SceneField::eFarPlane },
+		{ SceneField::eCamera, "up", SceneField::eUpList },
+		{ SceneField::eCamera, "path", SceneField::ePathList },
+		{ SceneField::eUpList, "[]", SceneField::eUp },
+		{ SceneField::ePathList, "[]", SceneField::eCameraKey },
+		{ SceneField::eCameraKey, "time", SceneField::eKeyTime },
+		{ SceneField::eCameraKey, "eye", SceneField::eEyeList },
+		{ SceneField::eCameraKey, "target", SceneField::eTargetList },
+		{ SceneField::eEyeList, "[]", SceneField::eEye },
+		{ SceneField::eTargetList, "[]", SceneField::eTarget }
+	};
+
+	auto found = std::find_if(std::begin(keys), std::end(keys), [&](const SceneKey& entry) {
+		return entry.parent == parent && key == entry.key;
+	});
+	return found == std::end(keys) ? SceneField::eNone : found->field;
+}
+
+// Streams parser events straight into a Scene. Keys and arrays are resolved to a field once as they open,
+// so values are routed by a switch instead of through an intermediate document. The path with arrays
+// marked as [] is kept per container for error messages only
+struct SceneParser : nlohmann::json_sax<nlohmann::json>
+{
+	Scene& scene;
+	std::vector<SceneField> scopes;
+	std::vector<std::string> names;
+	std::vector<uint32_t> counts;
+	std::vector<bool> arrays;
+	std::string field;
+	SceneField keyField = SceneField::eNone;
+	bool meshesRead = false;
+	bool pathRead = false;
+
+	explicit SceneParser(Scene& scene) : scene(scene)
+	{
+	}
+
+	// Field of the value about to be read, array elements also get their position
+	SceneField getField(uint32_t& element)
+	{
+		if (arrays.empty())
+			return SceneField::eRoot;
+		if (!arrays.back())
+			return keyField;
+
+		element = counts.back()++;
+		return scopes.back();
+	}
+
+	// Path of the value about to be read
+	std::string getName() const
+	{
+		if (arrays.empty())
+			return field;
+		if (!arrays.back())
+			return names.back().empty() ? field : names.back() + '.' + field;
+		return names.back();
+	}
+
+	void pushScope(SceneField scope, bool array)
+	{
+		names.push_back(array ? getName() + "[]" : getName());
+		scopes.push_back(scope);
+		counts.push_back(0);
+		arrays.push_back(array);
+	}
+
+	// Counts and indices have to be whole and fit their field, anything else would wrap or truncate in the cast
+	template<typename Unsigned>
+	Unsigned getUnsigned(double number) const
+	{
+		if (number < 0.0 || number != std::floor(number) ||
+			number >= std::ldexp(1.0, std::numeric_limits<Unsigned>::digits))
+			throw std::runtime_error("Unexpected number out of range in " + getName());
+		return static_cast<Unsigned>(number);
+	}
+
+	template<typename Value>
+	void setComponent(Value& value, uint32_t element, uint32_t components, float number)
+	{
+		if (element >= components)
+			throw std::runtime_error("Too many components in " + getName());
+		value[element] = number;
+	}
+
+	// Vertex attributes may come in any order, whichever arrives first grows the mesh
+	Vertex& getVertex(uint32_t element, uint32_t components)
+	{
+		auto& mesh = scene.meshes.back();
+		auto index = mesh.firstVertex + element / components;
+		if (index >= scene.vertices.size())
+			scene.vertices.resize(index + 1, Vertex{ glm::vec3(0.0f), glm::vec3(1.0f), glm::vec2(0.0f) });
+
+		mesh.vertexCount = std::max(mesh.vertexCount, index + 1 - mesh.firstVertex);
+		return scene.vertices.at(index);
+	}
+
+	bool setNumber(double number)
+	{
+		uint32_t element = 0;
+		auto value = static_cast<float>(number);
+
+		switch (getField(element))
+		{
+		case SceneField::eWidth:
+			scene.settings.width = getUnsigned<uint32_t>(number);
+			break;
+		case SceneField::eHeight:
+			scene.settings.height = getUnsigned<uint32_t>(number);
+			break;
+		case SceneField::eFramesInFlight:
+			scene.settings.framesInFlight = getUnsigned<uint32_t>(number);
+			break;
+		case SceneField::eSamples:
+			scene.settings.samples = getUnsigned<uint32_t>(number);
+			break;
+		case SceneField::eFrameRate:
+			scene.settings.frameRate = number;
+			break;
+		case SceneField::eFrames:
+			scene.settings.frames = getUnsigned<uint64_t>(number);
+			break;
+		case SceneField::eSpin:
+			scene.spin = value;
+			break;
+		case SceneField::ePosition:
+			getVertex(element, 3).pos[element % 3] = value;
+			break;
+		case SceneField::eColor:
+			getVertex(element, 3).col[element % 3] = value;
+			break;
+		case SceneField::eTexcoord:
+			getVertex(element, 2).tex[element % 2] = value;
+			break;
+		case SceneField::eIndex:
+			scene.indices.push_back(getUnsigned<uint32_t>(number));
+			scene.meshes.back().indexCount++;
+			break;
+		case SceneField::eInstanceMesh:
+			scene.instances.back().mesh = getUnsigned<uint32_t>(number);
+			break;
+		case SceneField::eInstanceParent:
+			scene.instances.back().parent = number < 0.0 ? rootTransform : getUnsigned<uint32_t>(number);
+			break;
+		case SceneField::eTranslation:
+			setComponent(scene.instances.back().translation, element, 3, value);
+			break;
+		case SceneField::eRotation:
+			setComponent(scene.instances.back().rotation, element, 3, value);
+			break;
+		case SceneField::eScale:
+			setComponent(scene.instances.back().scale, element, 3, value);
+			break;
+		case SceneField::eInstanceColor:
+			setComponent(scene.instances.back().color, element, 3, value);
+			break;
+		case SceneField::eFieldOfView:
+			scene.fieldOfView = value;
+			break;
+		case SceneField::eNearPlane:
+			scene.nearPlane = value;
+			break;
+		case SceneField::eFarPlane:
+			scene.farPlane = value;
+			break;
+		case SceneField::eUp:
+			setComponent(scene.up, element, 3, value);
+			break;
+		case SceneField::eKeyTime:
+			scene.cameraPath.back().time = value;
+			break;
+		case SceneField::eEye:
+			setComponent(scene.cameraPath.back().eye, element, 3, value);
+			break;
+		case SceneField::eTarget:
+			setComponent(scene.cameraPath.back().target, element, 3, value);
+			break;
+		default:
+			throw std::runtime_error("Unexpected number in " + getName());
+		}
+
+		return true;
+	}
+
+	bool null() override
+	{
+		throw std::runtime_error("Unexpected null in " + field);
+	}
+
+	bool boolean(bool value) override
+	{
+		static_cast<void>(value);
+		throw std::runtime_error("Unexpected boolean in " + field);
+	}
+
+	bool number_integer(number_integer_t value) override
+	{
+		return setNumber(static_cast<double>(value));
+	}
+
+	bool number_unsigned(number_unsigned_t value) override
+	{
+		return setNumber(static_cast<double>(value));
+	}
+
+	bool number_float(number_float_t value, const string_t& text) override
+	{
+		static_cast<void>(text);
+		return setNumber(value);
+	}
+
+	bool string(string_t& value) override
+	{
+		uint32_t element = 0;
+
+		switch (getField(element))
+		{
+		case SceneField::ePresent:
+			scene.settings.present = value;
+			break;
+		case SceneField::eShaders:
+			scene.settings.shaders = value;
+			break;
+		case SceneField::eMeshName:
+			break;
+		default:
+			throw std::runtime_error("Unexpected string in " + getName());
+		}
+
+		return true;
+	}
+
+	// Elements of the scene arrays are appended as they open, the first of each replaces the defaults
+	bool start_object(std::size_t elements) override
+	{
+		static_cast<void>(elements);
+		uint32_t element = 0;
+		auto scope = getField(element);
+
+		switch (scope)
+		{
+		case SceneField::eMesh:
+			if (!meshesRead)
+			{
+				scene.vertices.clear();
+				scene.indices.clear();
+				scene.meshes.clear();
+				meshesRead = true;
+			}
+			scene.meshes.push_back(SceneMesh{
+				static_cast<uint32_t>(scene.vertices.size()),
+				0,
+				static_cast<uint32_t>(scene.indices.size()),
+				0
+			});
+			break;
+		case SceneField::eInstance:
+			scene.instances.push_back(SceneInstance{
+				0,
+				rootTransform,
+				glm::vec3(0.0f),
+				glm::vec3(0.0f),
+				glm::vec3(1.0f),
+				glm::vec3(1.0f)
+			});
+			break;
+		case SceneField::eCameraKey:
+			if (!pathRead)
+			{
+				scene.cameraPath.clear();
+				pathRead = true;
+			}
+			scene.cameraPath.push_back(CameraKey{ 0.0f, glm::vec3(0.0f), glm::vec3(0.0f) });
+			break;
+		case SceneField::eRoot:
+		case SceneField::eSettings:
+		case SceneField::eScene:
+		case SceneField::eCamera:
+			break;
+		default:
+			throw std::runtime_error("Unexpected object in " + getName());
+		}
+
+		pushScope(scope, false);
+		return true;
+	}
+
+	bool key(string_t& value) override
+	{
+		field = value;
+		keyField = resolveField(scopes.back(), value);
+		return true;
+	}
+
+	bool end_object() override
+	{
+		scopes.pop_back();
+		names.pop_back();
+		counts.pop_back();
+		arrays.pop_back();
+		return true;
+	}
+
+	bool start_array(std::size_t elements) override
+	{
+		static_cast<void>(elements);
+		uint32_t element = 0;
+		auto scope = resolveField(getField(element), "[]");
+		if (scope == SceneField::eNone)
+			throw std::runtime_error("Unexpected array in " + getName());
+
+		pushScope(scope, true);
+		return true;
+	}
+
+	bool end_array() override
+	{
+		return end_object();
+	}
+
+	bool parse_error(std::size_t position, const std::string& token, const nlohmann::detail::exception& error) override
+	{
+		static_cast<void>(position);
+		static_cast<void>(token);
+		throw std::runtime_error(error.what());
+	}
+};
+
+// Settings and scene from a config file, anything it leaves out keeps the default scene's value
+inline Scene loadScene(const std::string& path)
+{
+	std::ifstream file(path);
+	if (!file)
+		throw std::runtime_error("Cannot open config " + path);
+
+	auto scene = getDefaultScene();
+	SceneParser parser(scene);
+	try {
+		nlohmann::json::sax_parse(file, &parser);
+	}
+	catch (const std::exception& error) {
+		throw std::runtime_error(path + ": " + error.what());
+	}
+
+	for (auto& mesh : scene.meshes)
+	{
+		if (!mesh.vertexCount)
+			throw std::runtime_error(path + ": mesh without vertices");
+		for (uint32_t i = mesh.firstIndex; i < mesh.firstIndex + mesh.indexCount; i++)
+			if (scene.indices.at(i) >= mesh.vertexCount)
+				throw std::runtime_error(path + ": mesh index out of range");
+	}
+	for (uint32_t i = 0; i < scene.instances.size(); i++)
+		if (scene.instances.at(i).mesh >= scene.meshes.size() ||
+			(scene.instances.at(i).parent != rootTransform && scene.instances.at(i).parent >= i))
+			throw std::runtime_error(path + ": instance " + std::to_string(i) + " has no such mesh or parent");
+
+	return scene;
+}
+
+// Instances are static, so they are flattened into one vertex and index array drawn as a single object.
+// Without instances every mesh is drawn once where it was modelled. Output ranges are laid out up front,
+// parallelFor(count, function(first, last)) may then fill instances from any thread
+template<typename ParallelFor>
+void bakeScene(const Scene& scene, std::vector<Vertex>& vertices, std::vector<uint32_t>& indices,
+	const ParallelFor& parallelFor)
+{
+	auto instances = scene.instances;
+	if (instances.empty())
+		for (uint32_t i = 0; i < scene.meshes.size(); i++)
+			instances.push_back(SceneInstance{ i, rootTransform, glm::vec3(0.0f), glm::vec3(0.0f), glm::vec3(1.0f), glm::vec3(1.0f) });
+
+	TransformHierarchy hierarchy;
+	std::vector<uint32_t> vertexOffsets, indexOffsets;
+	auto vertexCount = static_cast<uint32_t>(vertices.size());
+	auto indexCount = static_cast<uint32_t>(indices.size());
+	for (auto& instance : instances)
+	{
+		auto local = glm::translate(glm::mat4(1.0f), instance.translation);
+		local = glm::rotate(local, glm::radians(instance.rotation.z), glm::vec3(0.0f, 0.0f, 1.0f));
+		local = glm::rotate(local, glm::radians(instance.rotation.y), glm::vec3(0.0f, 1.0f, 0.0f));
+		local = glm::rotate(local, glm::radians(instance.rotation.x), glm::vec3(1.0f, 0.0f, 0.0f));
+		addTransform(hierarchy, instance.parent, glm::scale(local, instance.scale));
+
+		vertexOffsets.push_back(vertexCount);
+		indexOffsets.push_back(indexCount);
+		vertexCount += scene.meshes.at(instance.mesh).vertexCount;
+		indexCount += scene.meshes.at(instance.mesh).indexCount;
+	}
+	updateTransforms(hierarchy);
+	vertices.resize(vertexCount);
+	indices.resize(indexCount);
+
+	parallelFor(static_cast<uint32_t>(instances.size()), [&](uint32_t first, uint32_t last) {
+		for (uint32_t i = first; i < last; i++)
+		{
+			auto& mesh = scene.meshes.at(instances.at(i).mesh);
+			auto& world = getTransform(hierarchy, i);
+			auto vertex = vertices.begin() + vertexOffsets.at(i);
+			auto index = indices.begin() + indexOffsets.at(i);
+
+			for (uint32_t j = mesh.firstVertex; j < mesh.firstVertex + mesh.vertexCount; j++, vertex++)
+			{
+				*vertex = scene.vertices.at(j);
+				vertex->pos = glm::vec3(world * glm::vec4(vertex->pos, 1.0f));
+				vertex->col *= instances.at(i).color;
+			}
+			for (uint32_t j = mesh.firstIndex; j < mesh.firstIndex + mesh.indexCount; j++, index++)
+				*index = vertexOffsets.at(i) + scene.indices.at(j);
+		}
+	});
+}
+
+// Keys are interpolated linearly and the path loops after its last key
+inline glm::mat4 getCameraView(const Scene& scene, float time)
+{
+	auto& path = scene.cameraPath;
+	if (path.empty())
+		return glm::lookAt(glm::vec3(-2.0f, -2.0f, -2.0f), glm::vec3(0.0f), scene.up);
+	if (path.back().time > 0.0f)
+		time = std::fmod(time, path.back().time);
+
+	uint32_t key = 0;
+	while (key + 1 < path.size() && path.at(key + 1).time <= time)
+		key++;
+	if (key + 1 == path.size())
+		return glm::lookAt(path.at(key).eye, path.at(key).target, scene.up);
+
+	auto& from = path.at(key);
+	auto& to = path.at(key + 1);
+	auto blend = (time - from.time) / std::max(to.time - from.time, 1e-6f);
+	return glm::lookAt(glm::mix(from.eye, to.eye, blend), glm::mix(from.target, to.target, blend), scene.up);
+}
@@ -0,0 +1,399 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+constexpr uint32_t shaderMagic = 0x07230203;
+constexpr uint32_t shaderPackMagic = 0x4B415053;
+constexpr uint32_t shaderPackVersion = 1;
+constexpr uint32_t shaderNameLimit = 56;
+
+// Read-only view of a file, mapped where possible so SPIR-V goes to the driver without a copy
+struct ShaderFile
+{
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	std::vector<uint32_t> storage;
+};
+
+// Words of one module inside a ShaderFile, valid while the file stays open
+struct ShaderBinary
+{
+	const uint32_t* code;
+	size_t size;
+};
+
+// Archive layout: header, entry table, then every module at a 4-byte aligned offset
+struct ShaderPackHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t count;
+};
+
+struct ShaderPackEntry
+{
+	char name[shaderNameLimit];
+	uint32_t offset;
+	uint32_t size;
+};
+
+struct ShaderPack
+{
+	ShaderFile file;
+	std::vector<std::pair<std::string, ShaderBinary>> binaries;
+};
+
+inline ShaderFile openShaderFile(const std::string& path)
+{
+	ShaderFile file;
+#ifdef __linux__
+	int descriptor = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+	struct stat status;
+
+	if (descriptor < 0 || fstat(descriptor, &status) != 0)
+	{
+		if (descriptor >= 0)
+			close(descriptor);
+		throw std::runtime_error("Cannot open shader file " + path);
+	}
+
+	file.size = static_cast<size_t>(status.st_size);
+	if (file.size)
+	{
+		void* mapping = mmap(nullptr, file.size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, descriptor, 0);
+		if (mapping == MAP_FAILED)
+		{
+			close(descriptor);
+			throw std::runtime_error("Cannot map shader file " + path);
+		}
+		file.data = static_cast<const uint8_t*>(mapping);
+	}
+	close(descriptor);
+#else
+	std::ifstream stream(path, std::ios::binary | std::ios::ate);
+	if (!stream)
+		throw std::runtime_error("Cannot open shader file " + path);
+
+	file.size = static_cast<size_t>(stream.tellg());
+	stream.seekg(0, std::ios::beg);
+	file.storage.resize((file.size + sizeof(uint32_t) - 1) / sizeof(uint32_t));
+	stream.read(reinterpret_cast<char*>(file.storage.data()), file.size);
+	file.data = reinterpret_cast<const uint8_t*>(file.storage.data());
+#endif
+	return file;
+}
+
+inline void closeShaderFile(ShaderFile& file)
+{
+#ifdef __linux__
+	if (file.data)
+		munmap(const_cast<uint8_t*>(file.data), file.size);
+#endif
+	file.data = nullptr;
+	file.size = 0;
+	file.storage.clear();
+}
+
+inline ShaderBinary validateShaderBinary(const uint8_t* data, size_t size, const std::string& name)
+{
+	// Header is five words, the driver takes the code pointer as uint32_t so alignment matters too
+	if (size < 5 * sizeof(uint32_t) || size % sizeof(uint32_t) ||
+		reinterpret_cast<uintptr_t>(data) % alignof(uint32_t))
+		throw std::runtime_error("Malformed SPIR-V size or alignment in " + name);
+
+	auto code = reinterpret_cast<const uint32_t*>(data);
+	if (code[0] != shaderMagic)
+		throw std::runtime_error("Missing SPIR-V magic number in " + name);
+
+	return ShaderBinary{ code, size };
+}
+
+inline ShaderPack openShaderPack(const std::string& path)
+{
+	ShaderPack pack;
+	pack.file = openShaderFile(path);
+
+	auto& file = pack.file;
+	auto header = reinterpret_cast<const ShaderPackHeader*>(file.data);
+	if (file.size < sizeof(ShaderPackHeader) || header->magic != shaderPackMagic ||
+		header->version != shaderPackVersion ||
+		file.size < sizeof(ShaderPackHeader) + header->count * sizeof(ShaderPackEntry))
+	{
+		closeShaderFile(file);
+		throw std::runtime_error("Malformed shader pack " + path);
+	}
+
+	auto entries = reinterpret_cast<const ShaderPackEntry*>(file.data + sizeof(ShaderPackHeader));
+	try {
+		for (uint32_t i = 0; i < header->count; i++)
+		{
+			auto& entry = entries[i];
+			std::string name(entry.name, strnlen(entry.name, shaderNameLimit));
+
+			if (static_cast<uint64_t>(entry.offset) + entry.size > file.size)
+				throw std::runtime_error("Shader " + name + " runs past the end of " + path);
+
+			pack.binaries.emplace_back(name, validateShaderBinary(file.data + entry.offset, entry.size, name));
+		}
+	}
+	catch (...) {
+		closeShaderFile(file);
+		throw;
+	}
+
+	return pack;
+}
+
+inline const ShaderBinary& findShaderBinary(const ShaderPack& pack, const std::string& name)
+{
+	for (auto& binary : pack.binaries)
+		if (binary.first == name)
+			return binary.second;
+
+	throw std::runtime_error("Shader " + name + " missing from pack");
+}
+
+// Compiles GLSL through glslc into a content addressed SPIR-V cache and, when watching, recompiles
+// variants in a background thread whenever a source or one of its includes changes on disk
+struct ShaderVariant
+{
+	std::string path;
+	std::vector<std::string> defines;
+	uint64_t hash;
+};
+
+struct ShaderCompiler
+{
+	std::string directory;
+	std::string cacheDirectory;
+	std::vector<ShaderVariant> variants;
+	std::vector<std::pair<uint32_t, std::vector<uint32_t>>> updates;
+	std::mutex mutex;
+	std::thread watcher;
+	std::atomic<bool> running{ false };
+	int notifier = -1;
+};
+
+inline std::string readShaderText(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	std::ostringstream stream;
+	stream << file.rdbuf();
+	return stream.str();
+}
+
+inline uint64_t hashShaderBytes(uint64_t hash, const std::string& bytes)
+{
+	// FNV-1a, collisions only cost a stale cache entry and the inputs are small
+	for (auto byte : bytes)
+	{
+		hash ^= static_cast<uint8_t>(byte);
+		hash *= 0x100000001B3ull;
+	}
+
+	return hash;
+}
+
+inline uint64_t hashShaderSource(uint64_t hash, const std::string& path, uint32_t depth = 0)
+{
+	auto source = readShaderText(path);
+	hash = hashShaderBytes(hash, source);
+
+	if (depth > 8)
+		return hash;
+
+	// Quoted includes resolve next to the including file, the same way glslc looks them up
+	auto folder = path.substr(0, path.find_last_of('/') + 1);
+	std::istringstream lines(source);
+	std::string line;
+
+	while (std::getline(lines, line))
+	{
+		auto directive = line.find("#include");
+		auto begin = line.find('"');
+		auto end = line.rfind('"');
+
+		if (directive != std::string::npos && begin != std::string::npos && end > begin)
+			hash = hashShaderSource(hash, folder + line.substr(begin + 1, end - begin - 1), depth + 1);
+	}
+
+	return hash;
+}
+
+inline uint64_t hashShaderVariant(const std::string& path, const std::vector<std::string>& defines)
+{
+	uint64_t hash = 0xCBF29CE484222325ull;
+
+	for (auto& define : defines)
+		hash = hashShaderBytes(hash, define + '\n');
+
+	return hashShaderSource(hash, path);
+}
+
+inline std::string getShaderCachePath(ShaderCompiler& compiler, uint64_t hash)
+{
+	std::ostringstream stream;
+	stream << compiler.cacheDirectory << '/' << std::hex << std::setfill('0') << std::setw(16) << hash << ".spv";
+	return stream.str();
+}
+
+inline std::vector<uint32_t> readShaderBinary(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary | std::ios::ate);
+	if (!file)
+		return {};
+
+	auto size = static_cast<size_t>(file.tellg());
+	file.seekg(0, std::ios::beg);
+	std::vector<uint32_t> code(size / sizeof(uint32_t));
+	file.read(reinterpret_cast<char*>(code.data()), code.size() * sizeof(uint32_t));
+	return code;
+}
+
+inline void initializeShaderCompiler(ShaderCompiler& compiler, const std::string& directory)
+{
+	compiler.directory = directory;
+	compiler.cacheDirectory = directory + "/cache";
+#ifdef __linux__
+	mkdir(compiler.cacheDirectory.c_str(), 0755);
+#endif
+}
+
+inline uint32_t addShaderVariant(ShaderCompiler& compiler, const std::string& path, const std::vector<std::string>& defines)
+{
+	std::lock_guard<std::mutex> lock(compiler.mutex);
+	compiler.variants.push_back(ShaderVariant{ path, defines, hashShaderVariant(path, defines) });
+	return static_cast<uint32_t>(compiler.variants.size() - 1);
+}
+
+// Returns the SPIR-V of a variant, running glslc only when the cache has no binary for this exact input
+inline std::vector<uint32_t> compileShader(ShaderCompiler& compiler, const std::string& path,
+	const std::vector<std::string>& defines, uint64_t hash)
+{
+	auto cachePath = getShaderCachePath(compiler, hash);
+	auto code = readShaderBinary(cachePath);
+
+	if (!code.empty())
+		return code;
+
+	// Written under a temporary name and renamed, so a concurrent reader never sees a partial binary
+	auto temporaryPath = cachePath + ".tmp";
+	std::string command = "glslc -O \"" + path + "\" -o \"" + temporaryPath + "\"";
+	for (auto& define : defines)
+		command += " -D" + define;
+
+	if (std::system(command.c_str()) != 0 || std::rename(temporaryPath.c_str(), cachePath.c_str()) != 0)
+	{
+		std::remove(temporaryPath.c_str());
+		return {};
+	}
+
+	return readShaderBinary(cachePath);
+}
+
+inline void refreshShaderVariants(ShaderCompiler& compiler)
+{
+	std::vector<ShaderVariant> variants;
+	{
+		std::lock_guard<std::mutex> lock(compiler.mutex);
+		variants = compiler.variants;
+	}
+
+	for (uint32_t i = 0; i < variants.size(); i++)
+	{
+		auto hash = hashShaderVariant(variants.at(i).path, variants.at(i).defines);
+		if (hash == variants.at(i).hash)
+			continue;
+
+		auto code = compileShader(compiler, variants.at(i).path, variants.at(i).defines, hash);
+
+		std::lock_guard<std::mutex> lock(compiler.mutex);
+		compiler.variants.at(i).hash = hash;
+		if (!code.empty())
+			compiler.updates.emplace_back(i, std::move(code));
+	}
+}
+
+inline std::vector<std::pair<uint32_t, std::vector<uint32_t>>> takeShaderUpdates(ShaderCompiler& compiler)
+{
+	std::vector<std::pair<uint32_t, std::vector<uint32_t>>> updates;
+	std::lock_guard<std::mutex> lock(compiler.mutex);
+	updates.swap(compiler.updates);
+	return updates;
+}
+
+inline void startShaderWatcher(ShaderCompiler& compiler)
+{
+#ifdef __linux__
+	compiler.notifier = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (compiler.notifier < 0 || inotify_add_watch(compiler.notifier, compiler.directory.c_str(),
+		IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+	{
+		std::cerr << "Shader watcher unavailable for " << compiler.directory << '\n';
+		return;
+	}
+
+	compiler.running = true;
+	compiler.watcher = std::thread([&compiler]() {
+		alignas(inotify_event) char buffer[4096];
+		pollfd descriptor{ compiler.notifier, POLLIN, 0 };
+
+		while (compiler.running)
+		{
+			if (poll(&descriptor, 1, 100) <= 0)
+				continue;
+
+			bool changed = false;
+			while (read(compiler.notifier, buffer, sizeof(buffer)) > 0)
+				changed = true;
+
+			// Editors save in bursts, let them settle before hashing the sources
+			if (changed)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(50));
+				while (read(compiler.notifier, buffer, sizeof(buffer)) > 0)
+					continue;
+				refreshShaderVariants(compiler);
+			}
+		}
+	});
+#else
+	static_cast<void>(compiler);
+#endif
+}
+
+inline void stopShaderWatcher(ShaderCompiler& compiler)
+{
+	compiler.running = false;
+	if (compiler.watcher.joinable())
+		compiler.watcher.join();
+#ifdef __linux__
+	if (compiler.notifier >= 0)
+		close(compiler.notifier);
+	compiler.notifier = -1;
+#endif
+}
@@ -0,0 +1,59 @@
+#include <iostream>
+
+#include "shader.hpp"
+
+// Bundles compiled SPIR-V modules into one archive so the renderer maps all of them in a single call
+int main(int argc, char** argv)
+{
+	if (argc < 3)
+	{
+		std::cerr << "Usage: " << argv[0] << " <output.pak> <module.spv>..." << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	std::vector<ShaderFile> files;
+	std::vector<ShaderPackEntry> entries;
+	uint32_t offset = sizeof(ShaderPackHeader) + (argc - 2) * sizeof(ShaderPackEntry);
+
+	try {
+		for (int i = 2; i < argc; i++)
+		{
+			std::string path = argv[i];
+			auto name = path.substr(path.find_last_of('/') + 1);
+			ShaderPackEntry entry{};
+
+			if (name.size() >= shaderNameLimit)
+				throw std::runtime_error("Shader name too long: " + name);
+
+			files.push_back(openShaderFile(path));
+			validateShaderBinary(files.back().data, files.back().size, path);
+
+			name.copy(entry.name, shaderNameLimit - 1);
+			entry.offset = offset;
+			entry.size = static_cast<uint32_t>(files.back().size);
+			entries.push_back(entry);
+			offset += entry.size;
+		}
+	}
+	catch (std::exception& error) {
+		std::cerr << error.what() << std::endl;
+		return EXIT_FAILURE;
+	}
+
+	ShaderPackHeader header{
+		shaderPackMagic,
+		shaderPackVersion,
+		static_cast<uint32_t>(entries.size())
+	};
+
+	std::ofstream output(argv[1], std::ios::binary);
+	output.write(reinterpret_cast<const char*>(&header), sizeof(header));
+	output.write(reinterpret_cast<const char*>(entries.data()), entries.size() * sizeof(ShaderPackEntry));
+	for (auto& file : files)
+	{
+		output.write(reinterpret_cast<const char*>(file.data), file.size);
+		closeShaderFile(file);
+	}
+
+	return output ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,59 @@
+#ifndef SHADER_LAYOUT_H
+#define SHADER_LAYOUT_H
+
+// Data shared by the renderer and the shaders, included from both sides so the layouts cannot drift
+
+#ifdef __cplusplus
+#define VEC4 glm::vec4
+#define MAT4 glm::mat4
+#define UINT uint32_t
+#define INT int32_t
+#define UNIFORM_BLOCK(name, setIndex, bindingIndex) struct name
+#define BLOCK_INSTANCE(instance)
+#else
+#define VEC4 vec4
+#define MAT4 mat4
+#define UINT uint
+#define INT int
+#define UNIFORM_BLOCK(name, setIndex, bindingIndex) layout(set = setIndex, binding = bindingIndex) uniform name
+#define BLOCK_INSTANCE(instance) instance
+#endif
+
+struct ObjectData
+{
+	// Affine model matrix packed as its first three rows, the fourth is always (0, 0, 0, 1)
+	VEC4 model[3];
+};
+
+struct Material
+{
+	VEC4 color;
+	UINT textureIndex;
+};
+
+// Same layout as VkDrawIndexedIndirectCommand, written by the culling pass and consumed by indirect draws
+struct DrawCommand
+{
+	UINT indexCount;
+	UINT instanceCount;
+	UINT firstIndex;
+	INT vertexOffset;
+	UINT firstInstance;
+};
+
+struct CullData
+{
+	ObjectData object;
+	// Bounding sphere in model space, center in xyz and radius in w
+	VEC4 sphere;
+	UINT indexCount;
+	UINT material;
+};
+
+UNIFORM_BLOCK(Transformation, 0, 0)
+{
+	MAT4 viewProjection;
+	ObjectData object;
+} BLOCK_INSTANCE(transformation);
+
+#endif
@@ -1,11 +1,27 @@
 #version 460
 #extension GL_ARB_separate_shader_objects: enable
+#extension GL_EXT_nonuniform_qualifier: enable
+#extension GL_GOOGLE_include_directive: require
+
+#include "layout.h"
+
+layout(set = 1, binding = 0) readonly buffer Materials {
+	Material materials[];
+};
+
+layout(set = 1, binding = 1) uniform sampler2D textures[];
+
+layout(constant_id = 0) const bool textured = true;
 
 layout(location = 0) in vec3 inputColor;
+layout(location = 1) in vec2 inputTexture;
+layout(location = 2) flat in uint inputMaterial;
 
 layout(location = 0) out vec4 outputColor;
 
 void main()
 {
-	outputColor = vec4(inputColor, 1.0);
+	Material material = materials[inputMaterial];
+	vec4 texel = textured ? texture(textures[nonuniformEXT(material.textureIndex)], inputTexture) : vec4(1.0);
+	outputColor = material.color * texel * vec4(inputColor, 1.0);
 }
\ No newline at end of file
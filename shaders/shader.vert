@@ -1,19 +1,34 @@
 #version 460
 #extension GL_ARB_separate_shader_objects: enable
+#extension GL_GOOGLE_include_directive: require
 
-layout(binding = 0) uniform Transformation {
-    mat4 model;
-    mat4 view;
-    mat4 projection;
-} transformation;
+#include "layout.h"
+
+#ifdef UNIFORM_OBJECT
+#define OBJECT transformation.object
+#else
+layout(push_constant) uniform Draw {
+    ObjectData object;
+} draw;
+#define OBJECT draw.object
+#endif
 
 layout(location = 0) in vec3 inputPosition;
 layout(location = 1) in vec3 inputColor;
+layout(location = 2) in vec2 inputTexture;
 
 layout(location = 0) out vec3 outputColor;
+layout(location = 1) out vec2 outputTexture;
+layout(location = 2) flat out uint outputMaterial;
+
+invariant gl_Position;
 
 void main()
 {
-    gl_Position = transformation.projection * transformation.view * transformation.model * vec4(inputPosition, 1.0);
+    vec4 position = vec4(inputPosition, 1.0);
+    vec3 world = vec3(dot(OBJECT.model[0], position), dot(OBJECT.model[1], position), dot(OBJECT.model[2], position));
+    gl_Position = transformation.viewProjection * vec4(world, 1.0);
     outputColor = inputColor;
+    outputTexture = inputTexture;
+    outputMaterial = gl_InstanceIndex;
 }
\ No newline at end of file
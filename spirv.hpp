@@ -0,0 +1,416 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <stdexcept>
+#include <vector>
+
+#include <vulkan/vulkan.hpp>
+
+// Just enough of the SPIR-V grammar to recover the interface a pipeline layout and vertex input state need
+enum SpirvOp : uint32_t
+{
+	SpirvOpEntryPoint = 15,
+	SpirvOpTypeInt = 21,
+	SpirvOpTypeFloat = 22,
+	SpirvOpTypeVector = 23,
+	SpirvOpTypeMatrix = 24,
+	SpirvOpTypeImage = 25,
+	SpirvOpTypeSampler = 26,
+	SpirvOpTypeSampledImage = 27,
+	SpirvOpTypeArray = 28,
+	SpirvOpTypeRuntimeArray = 29,
+	SpirvOpTypeStruct = 30,
+	SpirvOpTypePointer = 32,
+	SpirvOpConstant = 43,
+	SpirvOpVariable = 59,
+	SpirvOpDecorate = 71,
+	SpirvOpMemberDecorate = 72,
+	SpirvOpTypeAccelerationStructure = 5341
+};
+
+enum SpirvDecoration : uint32_t
+{
+	SpirvDecorationBlock = 2,
+	SpirvDecorationBufferBlock = 3,
+	SpirvDecorationArrayStride = 6,
+	SpirvDecorationMatrixStride = 7,
+	SpirvDecorationBuiltIn = 11,
+	SpirvDecorationLocation = 30,
+	SpirvDecorationBinding = 33,
+	SpirvDecorationDescriptorSet = 34,
+	SpirvDecorationOffset = 35
+};
+
+enum SpirvStorage : uint32_t
+{
+	SpirvStorageUniformConstant = 0,
+	SpirvStorageInput = 1,
+	SpirvStorageUniform = 2,
+	SpirvStoragePushConstant = 9,
+	SpirvStorageStorageBuffer = 12
+};
+
+struct ReflectedBinding
+{
+	uint32_t set;
+	uint32_t binding;
+	vk::DescriptorType type;
+	uint32_t count;
+	vk::ShaderStageFlags stages;
+	bool runtimeArray;
+};
+
+struct ReflectedInput
+{
+	uint32_t location;
+	vk::Format format;
+	uint32_t size;
+};
+
+struct ShaderReflection
+{
+	vk::ShaderStageFlags stages;
+	std::vector<ReflectedBinding> bindings;
+	std::vector<ReflectedInput> inputs;
+	vk::ShaderStageFlags pushConstantStages;
+	uint32_t pushConstantSize = 0;
+};
+
+struct SpirvId
+{
+	uint32_t opcode = 0;
+	uint32_t type = 0;
+	uint32_t count = 0;
+	uint32_t width = 0;
+	uint32_t signedness = 0;
+	uint32_t storage = 0;
+	uint32_t dimension = 0;
+	uint32_t sampled = 0;
+	uint32_t value = 0;
+	uint32_t set = ~0u;
+	uint32_t binding = ~0u;
+	uint32_t location = ~0u;
+	uint32_t arrayStride = 0;
+	bool block = false;
+	bool bufferBlock = false;
+	bool builtIn = false;
+	std::vector<uint32_t> members;
+	std::vector<uint32_t> memberOffsets;
+	std::vector<uint32_t> memberMatrixStrides;
+};
+
+inline uint32_t getSpirvSize(const std::vector<SpirvId>& ids, uint32_t id, uint32_t matrixStride = 0)
+{
+	auto& type = ids.at(id);
+
+	switch (type.opcode)
+	{
+	case SpirvOpTypeInt:
+	case SpirvOpTypeFloat:
+		return type.width / 8;
+	case SpirvOpTypeVector:
+		return type.count * getSpirvSize(ids, type.type);
+	case SpirvOpTypeMatrix:
+		return type.count * (matrixStride ? matrixStride : getSpirvSize(ids, type.type));
+	case SpirvOpTypeArray:
+		return ids.at(type.count).value * (type.arrayStride ? type.arrayStride : getSpirvSize(ids, type.type));
+	case SpirvOpTypeStruct:
+	{
+		uint32_t size = 0;
+		for (uint32_t i = 0; i < type.members.size(); i++)
+			size = std::max(size, type.memberOffsets.at(i) +
+				getSpirvSize(ids, type.members.at(i), type.memberMatrixStrides.at(i)));
+		return size;
+	}
+	default:
+		return 0;
+	}
+}
+
+inline vk::Format getSpirvFormat(const std::vector<SpirvId>& ids, uint32_t id)
+{
+	auto& type = ids.at(id);
+	auto& scalar = type.opcode == SpirvOpTypeVector ? ids.at(type.type) : type;
+	auto count = type.opcode == SpirvOpTypeVector ? type.count : 1;
+
+	if (scalar.width != 32 || count < 1 || count > 4)
+		throw std::runtime_error("Unsupported vertex input type in SPIR-V");
+
+	std::array<vk::Format, 4> floats{
+		vk::Format::eR32Sfloat,
+		vk::Format::eR32G32Sfloat,
+		vk::Format::eR32G32B32Sfloat,
+		vk::Format::eR32G32B32A32Sfloat
+	};
+
+	std::array<vk::Format, 4> signedInts{
+		vk::Format::eR32Sint,
+		vk::Format::eR32G32Sint,
+		vk::Format::eR32G32B32Sint,
+		vk::Format::eR32G32B32A32Sint
+	};
+
+	std::array<vk::Format, 4> unsignedInts{
+		vk::Format::eR32Uint,
+		vk::Format::eR32G32Uint,
+		vk::Format::eR32G32B32Uint,
+		vk::Format::eR32G32B32A32Uint
+	};
+
+	if (scalar.opcode == SpirvOpTypeFloat)
+		return floats.at(count - 1);
+
+	return scalar.signedness ? signedInts.at(count - 1) : unsignedInts.at(count - 1);
+}
+
+inline vk::DescriptorType getSpirvDescriptorType(const std::vector<SpirvId>& ids, const SpirvId& variable, uint32_t id)
+{
+	auto& type = ids.at(id);
+
+	if (variable.storage == SpirvStorageStorageBuffer || type.bufferBlock)
+		return vk::DescriptorType::eStorageBuffer;
+	if (variable.storage == SpirvStorageUniform)
+		return vk::DescriptorType::eUniformBuffer;
+
+	switch (type.opcode)
+	{
+	case SpirvOpTypeSampler:
+		return vk::DescriptorType::eSampler;
+	case SpirvOpTypeSampledImage:
+		return ids.at(type.type).dimension == 5 ? vk::DescriptorType::eUniformTexelBuffer :
+			vk::DescriptorType::eCombinedImageSampler;
+	case SpirvOpTypeImage:
+		if (type.dimension == 6)
+			return vk::DescriptorType::eInputAttachment;
+		if (type.dimension == 5)
+			return type.sampled == 2 ? vk::DescriptorType::eStorageTexelBuffer : vk::DescriptorType::eUniformTexelBuffer;
+		return type.sampled == 2 ? vk::DescriptorType::eStorageImage : vk::DescriptorType::eSampledImage;
+	case SpirvOpTypeAccelerationStructure:
+		return vk::DescriptorType::eAccelerationStructureKHR;
+	default:
+		throw std::runtime_error("Unsupported resource type in SPIR-V");
+	}
+}
+
+inline ShaderReflection reflectShader(const uint32_t* code, size_t size)
+{
+	auto wordCount = static_cast<uint32_t>(size / sizeof(uint32_t));
+	if (wordCount < 5)
+		throw std::runtime_error("SPIR-V module too short to reflect");
+
+	ShaderReflection reflection;
+	std::vector<SpirvId> ids(code[3]);
+	std::vector<uint32_t> variables;
+
+	for (uint32_t offset = 5; offset < wordCount;)
+	{
+		auto opcode = code[offset] & 0xFFFF;
+		auto length = code[offset] >> 16;
+		auto operands = code + offset + 1;
+
+		if (!length || offset + length > wordCount)
+			throw std::runtime_error("Truncated SPIR-V instruction");
+
+		switch (opcode)
+		{
+		case SpirvOpEntryPoint:
+		{
+			std::array<vk::ShaderStageFlagBits, 6> models{
+				vk::ShaderStageFlagBits::eVertex,
+				vk::ShaderStageFlagBits::eTessellationControl,
+				vk::ShaderStageFlagBits::eTessellationEvaluation,
+				vk::ShaderStageFlagBits::eGeometry,
+				vk::ShaderStageFlagBits::eFragment,
+				vk::ShaderStageFlagBits::eCompute
+			};
+			if (operands[0] < models.size())
+				reflection.stages |= models.at(operands[0]);
+			break;
+		}
+		case SpirvOpTypeInt:
+			ids.at(operands[0]).signedness = operands[2];
+			[[fallthrough]];
+		case SpirvOpTypeFloat:
+			ids.at(operands[0]).opcode = opcode;
+			ids.at(operands[0]).width = operands[1];
+			break;
+		case SpirvOpTypeVector:
+		case SpirvOpTypeMatrix:
+		case SpirvOpTypeArray:
+			ids.at(operands[0]).opcode = opcode;
+			ids.at(operands[0]).type = operands[1];
+			ids.at(operands[0]).count = operands[2];
+			break;
+		case SpirvOpTypeRuntimeArray:
+		case SpirvOpTypeSampledImage:
+			ids.at(operands[0]).opcode = opcode;
+			ids.at(operands[0]).type = operands[1];
+			break;
+		case SpirvOpTypeImage:
+			ids.at(operands[0]).opcode = opcode;
+			ids.at(operands[0]).dimension = operands[2];
+			ids.at(operands[0]).sampled = operands[6];
+			break;
+		case SpirvOpTypeSampler:
+		case SpirvOpTypeAccelerationStructure:
+			ids.at(operands[0]).opcode = opcode;
+			break;
+		case SpirvOpTypeStruct:
+			ids.at(operands[0]).opcode = opcode;
+			ids.at(operands[0]).members.assign(operands + 1, operands + length - 1);
+			ids.at(operands[0]).memberOffsets.resize(length - 2, 0);
+			ids.at(operands[0]).memberMatrixStrides.resize(length - 2, 0);
+			break;
+		case SpirvOpTypePointer:
+			ids.at(operands[0]).opcode = opcode;
+			ids.at(operands[0]).storage = operands[1];
+			ids.at(operands[0]).type = operands[2];
+			break;
+		case SpirvOpConstant:
+			ids.at(operands[1]).opcode = opcode;
+			ids.at(operands[1]).value = operands[2];
+			break;
+		case SpirvOpVariable:
+			ids.at(operands[1]).opcode = opcode;
+			ids.at(operands[1]).type = operands[0];
+			ids.at(operands[1]).storage = operands[2];
+			variables.push_back(operands[1]);
+			break;
+		case SpirvOpDecorate:
+		{
+			auto& target = ids.at(operands[0]);
+			switch (operands[1])
+			{
+			case SpirvDecorationBlock: target.block = true; break;
+			case SpirvDecorationBufferBlock: target.bufferBlock = true; break;
+			case SpirvDecorationArrayStride: target.arrayStride = operands[2]; break;
+			case SpirvDecorationBuiltIn: target.builtIn = true; break;
+			case SpirvDecorationLocation: target.location = operands[2]; break;
+			case SpirvDecorationBinding: target.binding = operands[2]; break;
+			case SpirvDecorationDescriptorSet: target.set = operands[2]; break;
+			default: break;
+			}
+			break;
+		}
+		case SpirvOpMemberDecorate:
+		{
+			// Struct declarations precede their member decorations only by convention, so grow on demand
+			auto& target = ids.at(operands[0]);
+			if (target.memberOffsets.size() <= operands[1])
+			{
+				target.memberOffsets.resize(operands[1] + 1, 0);
+				target.memberMatrixStrides.resize(operands[1] + 1, 0);
+			}
+			if (operands[2] == SpirvDecorationOffset)
+				target.memberOffsets.at(operands[1]) = operands[3];
+			else if (operands[2] == SpirvDecorationMatrixStride)
+				target.memberMatrixStrides.at(operands[1]) = operands[3];
+			else if (operands[2] == SpirvDecorationBuiltIn)
+				target.builtIn = true;
+			break;
+		}
+		default:
+			break;
+		}
+
+		offset += length;
+	}
+
+	for (auto id : variables)
+	{
+		auto& variable = ids.at(id);
+		auto type = ids.at(variable.type).type;
+
+		if (variable.storage == SpirvStoragePushConstant)
+		{
+			reflection.pushConstantStages = reflection.stages;
+			reflection.pushConstantSize = std::max(reflection.pushConstantSize, getSpirvSize(ids, type));
+		}
+		else if (variable.storage == SpirvStorageInput && reflection.stages & vk::ShaderStageFlagBits::eVertex)
+		{
+			if (!variable.builtIn && !ids.at(type).builtIn && variable.location != ~0u)
+				reflection.inputs.push_back(ReflectedInput{
+					variable.location,
+					getSpirvFormat(ids, type),
+					getSpirvSize(ids, type)
+				});
+		}
+		else if (variable.storage == SpirvStorageUniformConstant || variable.storage == SpirvStorageUniform ||
+			variable.storage == SpirvStorageStorageBuffer)
+		{
+			if (variable.binding == ~0u)
+				continue;
+
+			uint32_t count = 1;
+			bool runtimeArray = false;
+
+			if (ids.at(type).opcode == SpirvOpTypeArray)
+			{
+				count = ids.at(ids.at(type).count).value;
+				type = ids.at(type).type;
+			}
+			else if (ids.at(type).opcode == SpirvOpTypeRuntimeArray)
+			{
+				count = 0;
+				runtimeArray = true;
+				type = ids.at(type).type;
+			}
+
+			reflection.bindings.push_back(ReflectedBinding{
+				variable.set == ~0u ? 0 : variable.set,
+				variable.binding,
+				getSpirvDescriptorType(ids, variable, type),
+				count,
+				reflection.stages,
+				runtimeArray
+			});
+		}
+	}
+
+	std::sort(reflection.inputs.begin(), reflection.inputs.end(), [](auto& left, auto& right) {
+		return left.location < right.location;
+	});
+
+	return reflection;
+}
+
+// Folds a stage into a pipeline wide interface, bindings shared between stages keep one entry
+inline void mergeReflection(ShaderReflection& pipeline, const ShaderReflection& stage)
+{
+	pipeline.stages |= stage.stages;
+	pipeline.pushConstantStages |= stage.pushConstantStages;
+	pipeline.pushConstantSize = std::max(pipeline.pushConstantSize, stage.pushConstantSize);
+	if (stage.stages & vk::ShaderStageFlagBits::eVertex)
+		pipeline.inputs = stage.inputs;
+
+	for (auto& binding : stage.bindings)
+	{
+		auto existing = std::find_if(pipeline.bindings.begin(), pipeline.bindings.end(), [&](auto& candidate) {
+			return candidate.set == binding.set && candidate.binding == binding.binding;
+		});
+
+		if (existing == pipeline.bindings.end())
+			pipeline.bindings.push_back(binding);
+		else if (existing->type != binding.type)
+			throw std::runtime_error("Stages disagree on a descriptor binding type");
+		else
+			existing->stages |= binding.stages;
+	}
+
+	std::sort(pipeline.bindings.begin(), pipeline.bindings.end(), [](auto& left, auto& right) {
+		return left.set != right.set ? left.set < right.set : left.binding < right.binding;
+	});
+}
+
+// Whether two merged reflections fit the same descriptor set and pipeline layouts, vertex inputs may differ
+inline bool isSameInterface(const ShaderReflection& left, const ShaderReflection& right)
+{
+	return left.pushConstantStages == right.pushConstantStages && left.pushConstantSize == right.pushConstantSize &&
+		std::equal(left.bindings.begin(), left.bindings.end(), right.bindings.begin(), right.bindings.end(),
+			[](const ReflectedBinding& a, const ReflectedBinding& b) {
+				return a.set == b.set && a.binding == b.binding && a.type == b.type && a.count == b.count &&
+					a.stages == b.stages && a.runtimeArray == b.runtimeArray;
+			});
+}
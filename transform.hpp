@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+#if defined(__SSE__) || defined(_M_X64)
+#include <immintrin.h>
+#endif
+
+#include <glm/glm.hpp>
+
+constexpr uint32_t rootTransform = std::numeric_limits<uint32_t>::max();
+
+// Scene graph flattened into parallel arrays. Handles returned by addTransform stay stable, while the
+// arrays are stored by slot and permuted into level order, so a level is one contiguous run of locals and
+// worlds and its parents sit in the run before it. Every node within a level can be updated independently
+struct TransformHierarchy
+{
+	std::vector<uint32_t> depths;
+	std::vector<uint32_t> slots;
+	std::vector<uint32_t> nodes;
+	std::vector<uint32_t> parents;
+	std::vector<glm::mat4> locals;
+	std::vector<glm::mat4> worlds;
+	std::vector<uint8_t> dirty;
+	std::vector<uint32_t> levels;
+	bool reordered = false;
+};
+
+// Column-major product, result must not alias either operand
+inline void multiplyTransform(const glm::mat4& left, const glm::mat4& right, glm::mat4& result)
+{
+	const float* a = &left[0][0];
+	const float* b = &right[0][0];
+	float* r = &result[0][0];
+
+#if defined(__AVX__)
+	// Both halves of a register hold the same left column, two result columns are built at once
+	__m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a));
+	__m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 4));
+	__m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 8));
+	__m256 a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 12));
+
+	for (uint32_t j = 0; j < 4; j += 2)
+	{
+		__m256 column = _mm256_loadu_ps(b + j * 4);
+		__m256 sum = _mm256_mul_ps(a0, _mm256_shuffle_ps(column, column, 0x00));
+#if defined(__FMA__)
+		sum = _mm256_fmadd_ps(a1, _mm256_shuffle_ps(column, column, 0x55), sum);
+		sum = _mm256_fmadd_ps(a2, _mm256_shuffle_ps(column, column, 0xAA), sum);
+		sum = _mm256_fmadd_ps(a3, _mm256_shuffle_ps(column, column, 0xFF), sum);
+#else
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(a1, _mm256_shuffle_ps(column, column, 0x55)));
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(a2, _mm256_shuffle_ps(column, column, 0xAA)));
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(a3, _mm256_shuffle_ps(column, column, 0xFF)));
+#endif
+		_mm256_storeu_ps(r + j * 4, sum);
+	}
+#elif defined(__SSE__) || defined(_M_X64)
+	__m128 a0 = _mm_loadu_ps(a);
+	__m128 a1 = _mm_loadu_ps(a + 4);
+	__m128 a2 = _mm_loadu_ps(a + 8);
+	__m128 a3 = _mm_loadu_ps(a + 12);
+
+	for (uint32_t j = 0; j < 4; j++)
+	{
+		__m128 column = _mm_loadu_ps(b + j * 4);
+		__m128 sum = _mm_mul_ps(a0, _mm_shuffle_ps(column, column, 0x00));
+		sum = _mm_add_ps(sum, _mm_mul_ps(a1, _mm_shuffle_ps(column, column, 0x55)));
+		sum = _mm_add_ps(sum, _mm_mul_ps(a2, _mm_shuffle_ps(column, column, 0xAA)));
+		sum = _mm_add_ps(sum, _mm_mul_ps(a3, _mm_shuffle_ps(column, column, 0xFF)));
+		_mm_storeu_ps(r + j * 4, sum);
+	}
+#else
+	static_cast<void>(a);
+	static_cast<void>(b);
+	static_cast<void>(r);
+	result = left * right;
+#endif
+}
+
+#if defined(__AVX__)
+// Two products per call, each half of a register belongs to one node
+inline void multiplyTransformPair(const glm::mat4& left0, const glm::mat4& right0, glm::mat4& result0,
+	const glm::mat4& left1, const glm::mat4& right1, glm::mat4& result1)
+{
+	auto combine = [](const glm::mat4& low, const glm::mat4& high, uint32_t column) {
+		return _mm256_insertf128_ps(_mm256_castps128_ps256(_mm_loadu_ps(&low[column][0])), _mm_loadu_ps(&high[column][0]), 1);
+	};
+
+	__m256 a0 = combine(left0, left1, 0);
+	__m256 a1 = combine(left0, left1, 1);
+	__m256 a2 = combine(left0, left1, 2);
+	__m256 a3 = combine(left0, left1, 3);
+
+	for (uint32_t j = 0; j < 4; j++)
+	{
+		__m256 column = combine(right0, right1, j);
+		__m256 sum = _mm256_mul_ps(a0, _mm256_shuffle_ps(column, column, 0x00));
+#if defined(__FMA__)
+		sum = _mm256_fmadd_ps(a1, _mm256_shuffle_ps(column, column, 0x55), sum);
+		sum = _mm256_fmadd_ps(a2, _mm256_shuffle_ps(column, column, 0xAA), sum);
+		sum = _mm256_fmadd_ps(a3, _mm256_shuffle_ps(column, column, 0xFF), sum);
+#else
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(a1, _mm256_shuffle_ps(column, column, 0x55)));
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(a2, _mm256_shuffle_ps(column, column, 0xAA)));
+		sum = _mm256_add_ps(sum, _mm256_mul_ps(a3, _mm256_shuffle_ps(column, column, 0xFF)));
+#endif
+		_mm_storeu_ps(&result0[j][0], _mm256_castps256_ps128(sum));
+		_mm_storeu_ps(&result1[j][0], _mm256_extractf128_ps(sum, 1));
+	}
+}
+#endif
+
+// New nodes are appended to the last slot until the next sort moves them into their level
+inline uint32_t addTransform(TransformHierarchy& hierarchy, uint32_t parent, const glm::mat4& local)
+{
+	auto node = static_cast<uint32_t>(hierarchy.slots.size());
+	auto slot = static_cast<uint32_t>(hierarchy.nodes.size());
+
+	hierarchy.depths.push_back(parent == rootTransform ? 0 : hierarchy.depths.at(parent) + 1);
+	hierarchy.slots.push_back(slot);
+	hierarchy.nodes.push_back(node);
+	hierarchy.parents.push_back(parent == rootTransform ? rootTransform : hierarchy.slots.at(parent));
+	hierarchy.locals.push_back(local);
+	hierarchy.worlds.push_back(local);
+	hierarchy.dirty.push_back(1);
+	hierarchy.reordered = true;
+
+	return node;
+}
+
+inline void setTransform(TransformHierarchy& hierarchy, uint32_t node, const glm::mat4& local)
+{
+	auto slot = hierarchy.slots.at(node);
+	hierarchy.locals.at(slot) = local;
+	hierarchy.dirty.at(slot) = 1;
+}
+
+inline const glm::mat4& getLocalTransform(const TransformHierarchy& hierarchy, uint32_t node)
+{
+	return hierarchy.locals.at(hierarchy.slots.at(node));
+}
+
+inline const glm::mat4& getTransform(const TransformHierarchy& hierarchy, uint32_t node)
+{
+	return hierarchy.worlds.at(hierarchy.slots.at(node));
+}
+
+template<typename Value>
+void permuteTransforms(std::vector<Value>& values, const std::vector<uint32_t>& destinations)
+{
+	std::vector<Value> permuted(values.size());
+	for (uint32_t i = 0; i < values.size(); i++)
+		permuted.at(destinations.at(i)) = values.at(i);
+	values.swap(permuted);
+}
+
+// Counting sort by depth keeps the current order within a level, so data added breadth first stays linear
+inline void sortTransformLevels(TransformHierarchy& hierarchy)
+{
+	uint32_t levelCount = 0;
+	for (auto depth : hierarchy.depths)
+		levelCount = std::max(levelCount, depth + 1);
+
+	hierarchy.levels.assign(levelCount + 1, 0);
+	for (auto depth : hierarchy.depths)
+		hierarchy.levels.at(depth + 1)++;
+	for (uint32_t i = 1; i < hierarchy.levels.size(); i++)
+		hierarchy.levels.at(i) += hierarchy.levels.at(i - 1);
+
+	auto offsets = hierarchy.levels;
+	std::vector<uint32_t> destinations(hierarchy.nodes.size());
+	for (uint32_t slot = 0; slot < hierarchy.nodes.size(); slot++)
+		destinations.at(slot) = offsets.at(hierarchy.depths.at(hierarchy.nodes.at(slot)))++;
+
+	for (auto& parent : hierarchy.parents)
+		if (parent != rootTransform)
+			parent = destinations.at(parent);
+	permuteTransforms(hierarchy.parents, destinations);
+	permuteTransforms(hierarchy.nodes, destinations);
+	permuteTransforms(hierarchy.locals, destinations);
+	permuteTransforms(hierarchy.worlds, destinations);
+	permuteTransforms(hierarchy.dirty, destinations);
+	for (uint32_t slot = 0; slot < hierarchy.nodes.size(); slot++)
+		hierarchy.slots.at(hierarchy.nodes.at(slot)) = slot;
+
+	hierarchy.reordered = false;
+}
+
+// Updates slots [begin, end) of a single level, safe to split across threads
+inline void updateTransformRange(TransformHierarchy& hierarchy, uint32_t begin, uint32_t end)
+{
+	const uint32_t* parents = hierarchy.parents.data();
+	const glm::mat4* locals = hierarchy.locals.data();
+	glm::mat4* worlds = hierarchy.worlds.data();
+	uint8_t* dirty = hierarchy.dirty.data();
+
+	auto update = [&](uint32_t slot) {
+		auto parent = parents[slot];
+		if (parent == rootTransform)
+		{
+			if (dirty[slot])
+				worlds[slot] = locals[slot];
+			return;
+		}
+
+		dirty[slot] |= dirty[parent];
+		if (dirty[slot])
+			multiplyTransform(worlds[parent], locals[slot], worlds[slot]);
+	};
+
+	uint32_t i = begin;
+#if defined(__AVX__)
+	// Pairs of dirty children share one pass through the registers, anything else takes the single path
+	for (; i + 1 < end; i += 2)
+	{
+		auto parent0 = parents[i];
+		auto parent1 = parents[i + 1];
+		if (parent0 == rootTransform || parent1 == rootTransform)
+		{
+			update(i);
+			update(i + 1);
+			continue;
+		}
+
+		dirty[i] |= dirty[parent0];
+		dirty[i + 1] |= dirty[parent1];
+		if (dirty[i] && dirty[i + 1])
+			multiplyTransformPair(worlds[parent0], locals[i], worlds[i], worlds[parent1], locals[i + 1], worlds[i + 1]);
+		else if (dirty[i])
+			multiplyTransform(worlds[parent0], locals[i], worlds[i]);
+		else if (dirty[i + 1])
+			multiplyTransform(worlds[parent1], locals[i + 1], worlds[i + 1]);
+	}
+#endif
+	for (; i < end; i++)
+		update(i);
+}
+
+// Levels depend on their parents and run one after another. forRange(begin, end, function(first, last))
+// may split the slots of one level across threads, but must return only once all of them are done
+template<typename ForRange>
+void updateTransforms(TransformHierarchy& hierarchy, const ForRange& forRange)
+{
+	if (hierarchy.reordered)
+		sortTransformLevels(hierarchy);
+
+	for (uint32_t level = 0; level + 1 < hierarchy.levels.size(); level++)
+		forRange(hierarchy.levels.at(level), hierarchy.levels.at(level + 1), [&hierarchy](uint32_t first, uint32_t last) {
+			updateTransformRange(hierarchy, first, last);
+		});
+
+	std::fill(hierarchy.dirty.begin(), hierarchy.dirty.end(), 0);
+}
+
+inline void updateTransforms(TransformHierarchy& hierarchy)
+{
+	updateTransforms(hierarchy, [](uint32_t begin, uint32_t end, const auto& function) { function(begin, end); });
+}
@@ -1,6 +1,20 @@
+#include <algorithm>
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <exception>
 #include <fstream>
 #include <iostream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
 #include <vulkan/vulkan.hpp>
 #include <GLFW/glfw3.h>
 
@@ -11,53 +25,276 @@
 #include <glm/glm.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
-struct Vertex
+#include "handoff.hpp"
+#include "jobs.hpp"
+#include "renderer.hpp"
+#include "scene.hpp"
+#include "shader.hpp"
+#include "spirv.hpp"
+#include "transform.hpp"
+#include "shaders/layout.h"
+
+// Default mode when TRIANGLE_MODE is not set at runtime, make MODE=... chooses it at build time
+#ifndef TRIANGLE_MODE
+#define TRIANGLE_MODE "debug"
+#endif
+
+static_assert(sizeof(Transformation) == 112, "Transformation must match its std140 layout");
+static_assert(sizeof(DrawCommand) == sizeof(VkDrawIndexedIndirectCommand), "Indirect commands must match Vulkan");
+static_assert(sizeof(Material) == 32, "Material must match its std430 array stride");
+
+struct PipelineState
 {
-	glm::vec3 pos;
-	glm::vec3 col;
+	vk::ShaderModule vertexShader;
+	vk::ShaderModule fragmentShader;
+	vk::PipelineLayout layout;
+	vk::RenderPass renderPass;
+	uint32_t subpass;
+	vk::Format colorFormat;
+	vk::Format depthFormat;
+	vk::SampleCountFlagBits samples;
+	vk::Extent2D extent;
+	uint32_t vertexStride;
+	vk::PrimitiveTopology topology;
+	vk::PolygonMode polygonMode;
+	vk::CullModeFlags cullMode;
+	vk::FrontFace frontFace;
+	vk::Bool32 depthWrite;
+	vk::CompareOp depthCompare;
+	vk::Bool32 blend;
+	std::vector<uint32_t> constants;
+
+	bool operator==(const PipelineState& other) const;
 };
 
-struct Transformation
+struct PipelineStateHash
+{
+	size_t operator()(const PipelineState& state) const;
+};
+
+// A failed compile stays ready with a null pipeline, so draws keep using the fallback instead of retrying
+struct PipelineEntry
+{
+	vk::Pipeline pipeline;
+	bool ready;
+	bool failed;
+};
+
+// Vertex inputs are copied into the job, reflection may be replaced by a reload while a worker compiles
+struct PipelineJob
+{
+	PipelineState state;
+	std::vector<ReflectedInput> inputs;
+};
+
+// Staging copies recorded on the transfer queue, handed over to the graphics queue when submitted
+struct UploadBatch
+{
+	vk::CommandBuffer transferBuffer;
+	vk::CommandBuffer acquireBuffer;
+	vk::Semaphore semaphore;
+	std::vector<std::pair<vk::Buffer, vk::DeviceMemory>> stagingBuffers;
+};
+
+// A handle destroyed once the frame timeline reaches the last frame that used it, pool is set for objects
+// freed back to one
+struct RetiredResource
+{
+	uint64_t frameValue;
+	vk::ObjectType type;
+	uint64_t handle;
+	uint64_t pool;
+};
+
+// Debug validates everything, profile keeps only GPU labels for capture tools, release enables nothing
+enum class BuildMode
+{
+	eDebug,
+	eProfile,
+	eRelease
+};
+
+enum class PresentPolicy
+{
+	eBalanced,
+	eLowLatency,
+	eVsync,
+	eFrameCap,
+	eThroughput
+};
+
+// Simulation state of one frame, produced while the frame before it is being recorded and submitted
+struct FrameSnapshot
 {
-	glm::mat4 model;
 	glm::mat4 view;
-	glm::mat4 projection;
+	ObjectData object;
+	std::chrono::steady_clock::time_point sampleTime;
+};
+
+// When a frame sampled its state and was handed to present, latency is taken once the frame timeline passes it
+struct FrameTiming
+{
+	uint64_t frameValue;
+	std::chrono::steady_clock::time_point input;
+	std::chrono::steady_clock::time_point present;
+};
+
+// What device memory is spent on, heaps are budgeted as a whole but reported by category
+enum class MemoryCategory
+{
+	eGeometry,
+	eTextures,
+	eUniforms,
+	eIndirect,
+	eStaging,
+	eAttachments,
+	eCount
+};
+
+struct MemoryAllocation
+{
+	uint32_t heap;
+	MemoryCategory category;
+	vk::DeviceSize size;
+};
+
+// Budget and usage come from VK_EXT_memory_budget when it is exposed, otherwise the budget is a share of the
+// heap and usage is only what this renderer allocated
+struct HeapBudget
+{
+	vk::MemoryHeapFlags flags;
+	vk::DeviceSize size;
+	vk::DeviceSize budget;
+	vk::DeviceSize usage;
+	vk::DeviceSize allocated;
+	vk::DeviceSize peak;
+	std::array<vk::DeviceSize, static_cast<size_t>(MemoryCategory::eCount)> categories;
+};
+
+// Source texels stay on the host so the image can be rebuilt when the level bias changes
+struct Texture
+{
+	vk::Image image;
+	vk::DeviceMemory memory;
+	vk::ImageView view;
+	std::vector<uint8_t> pixels;
+	uint32_t width;
+	uint32_t height;
+	uint32_t levelBias;
 };
 
+Scene scene;
+JobSystem jobs;
 GLFWwindow* window;
 uint32_t width, height;
 
 vk::Instance instance;
 vk::DispatchLoaderDynamic loader;
+BuildMode buildMode;
+bool debugLabels;
 vk::DebugUtilsMessengerEXT messenger;
 vk::SurfaceKHR surface;
-uint32_t deviceIndex, queueIndex;
+uint32_t deviceIndex, queueIndex, transferIndex, computeIndex;
 vk::PhysicalDevice physicalDevice;
 vk::Device device;
-vk::Queue queue;
-vk::CommandPool commandPool;
+vk::Queue queue, transferQueue, computeQueue;
+vk::CommandPool commandPool, transferPool, computePool;
+UploadBatch upload;
 vk::SwapchainKHR swapchain;
 vk::Format swapchainFormat;
 vk::Rect2D swapchainArea;
 std::vector<vk::Image> swapchainImages;
 std::vector<vk::ImageView> swapchainViews;
+vk::Format depthFormat;
+vk::Image depthImage;
+vk::DeviceMemory depthMemory;
+vk::ImageView depthView;
+vk::SampleCountFlagBits sampleCount;
+vk::Image colorImage;
+vk::DeviceMemory colorMemory;
+vk::ImageView colorView;
+bool depthPrepass;
+bool asyncCompute;
+bool dynamicViewport, dynamicRendering, extendedDynamicState;
 vk::RenderPass renderPass;
-vk::ShaderModule vertexShader, fragmentShader;
-vk::DescriptorSetLayout descriptorSetLayout;
-vk::DescriptorPool descriptorPool;
+vk::ShaderModule vertexShader, fragmentShader, cullShader;
+ShaderReflection vertexReflection, fragmentReflection, cullReflection;
+std::map<std::vector<uint32_t>, vk::DescriptorSetLayout> setLayoutCache;
+std::map<std::vector<uint64_t>, vk::PipelineLayout> pipelineLayoutCache;
+ShaderCompiler shaderCompiler;
+uint32_t vertexVariant, fragmentVariant;
+bool hotReload;
+vk::DescriptorSetLayout descriptorSetLayout, bindlessSetLayout;
+vk::DescriptorPool descriptorPool, bindlessPool;
 std::vector<vk::DescriptorSet> descriptorSets;
+vk::DescriptorSet bindlessSet;
+uint32_t textureLimit, materialLimit, drawMaterial;
+vk::Sampler sampler;
+std::vector<Texture> textures;
+vk::Buffer materialBuffer;
+vk::DeviceMemory materialMemory;
+Material* materialData;
+uint32_t materialCount;
 vk::PipelineLayout pipelineLayout;
-vk::Pipeline pipeline;
+PipelineState mainState, prepassState, fallbackState;
+vk::PipelineCache pipelineCache;
+std::unordered_map<PipelineState, PipelineEntry, PipelineStateHash> pipelineRegistry;
+uint64_t pipelineLookups, pipelineCompiles, pipelineFailures;
+std::deque<PipelineJob> pipelineJobs;
+std::vector<std::thread> pipelineWorkers;
+std::mutex pipelineMutex;
+std::condition_variable pipelineSignal, pipelineIdle;
+uint32_t pipelineBusy;
+bool pipelineRunning;
 std::vector<Vertex> vertices;
 std::vector<uint32_t> indices;
+glm::vec4 drawBounds;
 vk::Buffer vertexBuffer, indexBuffer;
 vk::DeviceMemory vertexMemory, indexMemory;
 std::vector<vk::Buffer> uniformBuffers;
 std::vector<vk::DeviceMemory> uniformMemories;
+vk::DescriptorSetLayout cullSetLayout;
+vk::DescriptorPool cullPool;
+std::vector<vk::DescriptorSet> cullSets;
+vk::PipelineLayout cullPipelineLayout;
+vk::Pipeline cullPipeline;
+std::vector<vk::Buffer> indirectBuffers;
+std::vector<vk::DeviceMemory> indirectMemories;
+std::vector<vk::CommandBuffer> computeBuffers;
+vk::Semaphore computeSemaphore;
+uint64_t computeValue;
 std::vector<vk::Framebuffer> framebuffers;
 std::vector<vk::CommandBuffer> commandBuffers;
+TransformHierarchy hierarchy;
+uint32_t drawNode;
+ObjectData objectData;
+bool pushConstants;
 uint32_t syncLimit;
-std::vector<vk::Fence> frameFences;
+PresentPolicy presentPolicy;
+std::chrono::steady_clock::duration frameInterval;
+std::chrono::steady_clock::time_point frameDeadline;
+bool reportLatency;
+uint64_t frameLimit;
+std::deque<FrameTiming> frameTimings;
+std::chrono::steady_clock::time_point latencyStart;
+std::chrono::duration<double, std::milli> presentLatency, completeLatency;
+uint32_t latencySamples;
+bool threadedUpdate;
+Handoff<FrameSnapshot> snapshots;
+std::thread updateThread;
+std::exception_ptr updateError;
+std::chrono::steady_clock::time_point animationStart;
+vk::Semaphore frameSemaphore;
+uint64_t frameValue, submittedFrame, completedFrame;
+std::vector<uint64_t> imageValues;
+std::deque<RetiredResource> retiredResources;
+bool memoryBudget, reportMemory;
+std::vector<HeapBudget> heapBudgets;
+std::unordered_map<uint64_t, MemoryAllocation> memoryAllocations;
+vk::PhysicalDeviceMemoryProperties memoryProperties;
+bool unifiedMemory;
+std::chrono::steady_clock::time_point memoryUpdate;
+uint32_t textureLevelBias;
 std::vector<vk::Semaphore> imageSemaphores, renderSemaphores;
 
 VKAPI_ATTR VkBool32 VKAPI_CALL messageCallback(VkDebugUtilsMessageSeverityFlagBitsEXT severity,
@@ -65,17 +302,377 @@ VKAPI_ATTR VkBool32 VKAPI_CALL messageCallback(VkDebugUtilsMessageSeverityFlagBi
 	void* pUserData)
 {
 	(void)type;
-	(void)severity;
 	(void)pUserData;
 
-	std::cout << pCallbackData->pMessage << std::endl;
+	// Only errors are flushed, a burst of warnings should not serialize on the terminal
+	if (severity & VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT)
+		std::cerr << pCallbackData->pMessage << std::endl;
+	else
+		std::cout << pCallbackData->pMessage << '\n';
 	return VK_FALSE;
 }
 
+// Frame n is complete once the frame timeline reaches n, every submission of that frame and everything
+// earlier on the graphics queue has finished by then
+bool isFrameComplete(uint64_t value)
+{
+	if (completedFrame < value)
+		completedFrame = device.getSemaphoreCounterValue(frameSemaphore);
+
+	return completedFrame >= value;
+}
+
+void waitFrame(uint64_t value)
+{
+	if (isFrameComplete(value))
+		return;
+
+	vk::SemaphoreWaitInfo waitInfo{
+		vk::SemaphoreWaitFlags(),
+		1,
+		&frameSemaphore,
+		&value
+	};
+
+	static_cast<void>(device.waitSemaphores(waitInfo, std::numeric_limits<uint64_t>::max()));
+	completedFrame = value;
+}
+
+template<typename Handle>
+uint64_t getRawHandle(Handle handle)
+{
+	return reinterpret_cast<uint64_t>(static_cast<typename Handle::CType>(handle));
+}
+
+template<typename Handle>
+Handle getHandle(uint64_t handle)
+{
+	return Handle(reinterpret_cast<typename Handle::CType>(handle));
+}
+
+// Defaults to the last submitted frame, anything recorded after it must pass the frame it is recorded into
+template<typename Handle>
+void retireResource(Handle handle, uint64_t lastUse = frameValue, vk::CommandPool pool = nullptr)
+{
+	if (!handle)
+		return;
+
+	retiredResources.push_back(RetiredResource{
+		lastUse,
+		Handle::objectType,
+		getRawHandle(handle),
+		getRawHandle(pool)
+	});
+}
+
+template<typename Handle>
+void retireResources(const std::vector<Handle>& handles, uint64_t lastUse = frameValue, vk::CommandPool pool = nullptr)
+{
+	for (auto& handle : handles)
+		retireResource(handle, lastUse, pool);
+}
+
+void freeMemory(vk::DeviceMemory memory)
+{
+	auto allocation = memoryAllocations.find(getRawHandle(memory));
+	if (allocation != memoryAllocations.end())
+	{
+		auto& heap = heapBudgets.at(allocation->second.heap);
+		heap.allocated -= allocation->second.size;
+		heap.categories.at(static_cast<size_t>(allocation->second.category)) -= allocation->second.size;
+		memoryAllocations.erase(allocation);
+	}
+
+	device.freeMemory(memory, nullptr);
+}
+
+// Idle destroys everything, for when the device was drained and no further frame will complete
+void destroyRetired(bool idle)
+{
+	while (!retiredResources.empty() && (idle || isFrameComplete(retiredResources.front().frameValue)))
+	{
+		auto& resource = retiredResources.front();
+
+		switch (resource.type)
+		{
+		case vk::ObjectType::eBuffer:
+			device.destroyBuffer(getHandle<vk::Buffer>(resource.handle), nullptr);
+			break;
+		case vk::ObjectType::eDeviceMemory:
+			freeMemory(getHandle<vk::DeviceMemory>(resource.handle));
+			break;
+		case vk::ObjectType::eImage:
+			device.destroyImage(getHandle<vk::Image>(resource.handle), nullptr);
+			break;
+		case vk::ObjectType::eImageView:
+			device.destroyImageView(getHandle<vk::ImageView>(resource.handle), nullptr);
+			break;
+		case vk::ObjectType::eFramebuffer:
+			device.destroyFramebuffer(getHandle<vk::Framebuffer>(resource.handle), nullptr);
+			break;
+		case vk::ObjectType::ePipeline:
+			device.destroyPipeline(getHandle<vk::Pipeline>(resource.handle), nullptr);
+			break;
+		case vk::ObjectType::eDescriptorPool:
+			device.destroyDescriptorPool(getHandle<vk::DescriptorPool>(resource.handle), nullptr);
+			break;
+		case vk::ObjectType::eSemaphore:
+			device.destroySemaphore(getHandle<vk::Semaphore>(resource.handle), nullptr);
+			break;
+		case vk::ObjectType::eSwapchainKHR:
+			device.destroySwapchainKHR(getHandle<vk::SwapchainKHR>(resource.handle), nullptr);
+			break;
+		case vk::ObjectType::eCommandBuffer:
+		{
+			auto commandBuffer = getHandle<vk::CommandBuffer>(resource.handle);
+			device.freeCommandBuffers(getHandle<vk::CommandPool>(resource.pool), 1, &commandBuffer);
+			break;
+		}
+		default:
+			throw std::logic_error("Retired resource type has no destroy path");
+		}
+
+		retiredResources.pop_front();
+	}
+}
+
+uint32_t findPresentFamily(vk::PhysicalDevice candidate)
+{
+	auto families = candidate.getQueueFamilyProperties();
+	for (uint32_t i = 0; i < families.size(); i++)
+		if (families.at(i).queueCount && families.at(i).queueFlags & vk::QueueFlagBits::eGraphics &&
+			candidate.getSurfaceSupportKHR(i, surface))
+			return i;
+
+	return std::numeric_limits<uint32_t>::max();
+}
+
+bool hasExtension(const std::vector<vk::ExtensionProperties>& extensions, const char* name)
+{
+	return std::any_of(extensions.begin(), extensions.end(),
+		[name](const vk::ExtensionProperties& extension) { return std::strcmp(extension.extensionName, name) == 0; });
+}
+
+vk::DeviceSize getDeviceLocalSize(vk::PhysicalDevice candidate)
+{
+	vk::DeviceSize size = 0;
+	auto memoryProperties = candidate.getMemoryProperties();
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+		if (memoryProperties.memoryHeaps[i].flags & vk::MemoryHeapFlagBits::eDeviceLocal)
+			size = std::max(size, memoryProperties.memoryHeaps[i].size);
+
+	return size;
+}
+
+// Zero when the device cannot run the renderer at all
+uint64_t scoreDevice(vk::PhysicalDevice candidate)
+{
+	auto properties = candidate.getProperties();
+	auto extensions = candidate.enumerateDeviceExtensionProperties();
+
+	if (properties.apiVersion < VK_API_VERSION_1_2 || findPresentFamily(candidate) == std::numeric_limits<uint32_t>::max() ||
+		!hasExtension(extensions, VK_KHR_SWAPCHAIN_EXTENSION_NAME) || candidate.getSurfaceFormatsKHR(surface).empty() ||
+		candidate.getSurfacePresentModesKHR(surface).empty())
+		return 0;
+
+	auto featureChain = candidate.getFeatures2<vk::PhysicalDeviceFeatures2, vk::PhysicalDeviceVulkan12Features>();
+	auto& features = featureChain.get<vk::PhysicalDeviceFeatures2>().features;
+	auto& indexingFeatures = featureChain.get<vk::PhysicalDeviceVulkan12Features>();
+
+	// Culled draws carry their material as firstInstance of an indirect command
+	if (!features.fillModeNonSolid || !features.wideLines || !features.drawIndirectFirstInstance ||
+		!indexingFeatures.descriptorIndexing || !indexingFeatures.runtimeDescriptorArray ||
+		!indexingFeatures.shaderSampledImageArrayNonUniformIndexing || !indexingFeatures.descriptorBindingPartiallyBound ||
+		!indexingFeatures.descriptorBindingVariableDescriptorCount ||
+		!indexingFeatures.descriptorBindingSampledImageUpdateAfterBind ||
+		!indexingFeatures.descriptorBindingUpdateUnusedWhilePending || !indexingFeatures.timelineSemaphore)
+		return 0;
+
+	// Device type dominates so a software rasterizer only wins when nothing else qualifies, then local
+	// memory in MiB, then separate transfer and compute families and the optional extensions
+	uint64_t typeRank = 1;
+	if (properties.deviceType == vk::PhysicalDeviceType::eDiscreteGpu)
+		typeRank = 4;
+	else if (properties.deviceType == vk::PhysicalDeviceType::eIntegratedGpu)
+		typeRank = 3;
+	else if (properties.deviceType == vk::PhysicalDeviceType::eVirtualGpu)
+		typeRank = 2;
+
+	uint64_t score = typeRank << 32;
+	score += getDeviceLocalSize(candidate) >> 20;
+
+	for (auto& family : candidate.getQueueFamilyProperties())
+	{
+		if (family.queueFlags & vk::QueueFlagBits::eGraphics)
+			continue;
+		score += family.queueFlags & vk::QueueFlagBits::eCompute ? 1024 : 512;
+	}
+	if (hasExtension(extensions, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME))
+		score += 256;
+	if (hasExtension(extensions, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME))
+		score += 256;
+
+	return score;
+}
+
+void pickDevice()
+{
+	auto devices = instance.enumeratePhysicalDevices();
+	auto requested = std::getenv("TRIANGLE_DEVICE");
+	bool byIndex = requested && std::strspn(requested, "0123456789") == std::strlen(requested);
+	uint64_t bestScore = 0;
+
+	// TRIANGLE_DEVICE takes an index or part of a device name and bypasses the ranking
+	for (uint32_t i = 0; i < devices.size(); i++)
+	{
+		auto score = scoreDevice(devices.at(i));
+		std::string name = devices.at(i).getProperties().deviceName;
+		std::cout << "Device " << i << ": " << name << (score ? "" : " (unsuitable)") << '\n';
+
+		bool chosen = score > bestScore;
+		if (requested)
+			chosen = byIndex ? std::to_string(i) == requested : name.find(requested) != std::string::npos;
+		if (!chosen || (requested && bestScore))
+			continue;
+		if (!score)
+			throw vk::FeatureNotPresentError(name + " cannot run the renderer");
+
+		bestScore = score;
+		deviceIndex = i;
+	}
+
+	if (!bestScore)
+		throw vk::FeatureNotPresentError(requested ? "TRIANGLE_DEVICE matches no device" : "No suitable device");
+
+	physicalDevice = devices.at(deviceIndex);
+}
+
+// Integrated GPUs with device local memory the host can map are unified, their buffers skip staging copies
+void queryMemoryProperties()
+{
+	memoryProperties = physicalDevice.getMemoryProperties();
+
+	auto mappable = vk::MemoryPropertyFlagBits::eDeviceLocal | vk::MemoryPropertyFlagBits::eHostVisible |
+		vk::MemoryPropertyFlagBits::eHostCoherent;
+	unifiedMemory = false;
+	if (physicalDevice.getProperties().deviceType == vk::PhysicalDeviceType::eIntegratedGpu)
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+			if ((memoryProperties.memoryTypes[i].propertyFlags & mappable) == mappable)
+				unifiedMemory = true;
+}
+
+void reportDevice()
+{
+	auto properties = physicalDevice.getProperties();
+	auto& limits = properties.limits;
+
+	std::cout << "Using " << properties.deviceName << " (" << vk::to_string(properties.deviceType) << ")\n"
+		<< "  API " << VK_VERSION_MAJOR(properties.apiVersion) << '.' << VK_VERSION_MINOR(properties.apiVersion) << '.'
+		<< VK_VERSION_PATCH(properties.apiVersion) << ", driver " << properties.driverVersion << '\n'
+		<< "  Device local memory " << (getDeviceLocalSize(physicalDevice) >> 20) << " MiB"
+		<< (unifiedMemory ? ", unified" : "") << '\n'
+		<< "  Queue families graphics " << queueIndex << ", transfer " << transferIndex << ", compute " << computeIndex << '\n'
+		<< "  Max image 2D " << limits.maxImageDimension2D << ", push constants " << limits.maxPushConstantsSize
+		<< " bytes, bound sets " << limits.maxBoundDescriptorSets << '\n'
+		<< "  Max update after bind sampled images " << physicalDevice.getProperties2<vk::PhysicalDeviceProperties2,
+			vk::PhysicalDeviceVulkan12Properties>().get<vk::PhysicalDeviceVulkan12Properties>()
+			.maxPerStageDescriptorUpdateAfterBindSampledImages << '\n'
+		<< "  Color samples " << vk::to_string(limits.framebufferColorSampleCounts) << ", timestamp period "
+		<< limits.timestampPeriod << " ns" << std::endl;
+}
+
+void chooseQueueFamilies()
+{
+	auto families = physicalDevice.getQueueFamilyProperties();
+	queueIndex = findPresentFamily(physicalDevice);
+
+	// Families without graphics run beside it on separate hardware queues, the graphics family stands in
+	// for either when there is none
+	transferIndex = queueIndex;
+	computeIndex = queueIndex;
+	for (uint32_t i = 0; i < families.size(); i++)
+	{
+		auto flags = families.at(i).queueFlags;
+		if (flags & vk::QueueFlagBits::eGraphics)
+			continue;
+		if (flags & vk::QueueFlagBits::eCompute && computeIndex == queueIndex)
+			computeIndex = i;
+		else if (!(flags & vk::QueueFlagBits::eCompute) && flags & vk::QueueFlagBits::eTransfer && transferIndex == queueIndex)
+			transferIndex = i;
+	}
+}
+
+BuildMode getBuildMode(const char* name)
+{
+	if (std::strcmp(name, "debug") == 0)
+		return BuildMode::eDebug;
+	if (std::strcmp(name, "profile") == 0)
+		return BuildMode::eProfile;
+	if (std::strcmp(name, "release") == 0)
+		return BuildMode::eRelease;
+
+	throw std::invalid_argument(std::string("TRIANGLE_MODE has no mode ") + name);
+}
+
+bool hasInstanceExtension(const char* name)
+{
+	for (auto& extension : vk::enumerateInstanceExtensionProperties())
+		if (std::strcmp(extension.extensionName, name) == 0)
+			return true;
+
+	return false;
+}
+
+PresentPolicy getPresentPolicy(const char* name)
+{
+	if (std::strcmp(name, "balanced") == 0)
+		return PresentPolicy::eBalanced;
+	if (std::strcmp(name, "latency") == 0)
+		return PresentPolicy::eLowLatency;
+	if (std::strcmp(name, "vsync") == 0)
+		return PresentPolicy::eVsync;
+	if (std::strcmp(name, "cap") == 0)
+		return PresentPolicy::eFrameCap;
+	if (std::strcmp(name, "throughput") == 0)
+		return PresentPolicy::eThroughput;
+
+	throw std::invalid_argument(std::string("No present policy ") + name);
+}
+
 void initializeBase()
 {
-	width = 800;
-	height = 600;
+	// Environment switches override the config, which overrides the built-in scene
+	auto config = std::getenv("TRIANGLE_CONFIG");
+	scene = config ? loadScene(config) : getDefaultScene();
+	width = scene.settings.width;
+	height = scene.settings.height;
+	depthPrepass = std::getenv("TRIANGLE_PREPASS") != nullptr;
+	hotReload = std::getenv("TRIANGLE_HOT_RELOAD") != nullptr;
+	dynamicViewport = std::getenv("TRIANGLE_STATIC_STATE") == nullptr;
+	asyncCompute = std::getenv("TRIANGLE_INLINE_COMPUTE") == nullptr;
+	auto present = std::getenv("TRIANGLE_PRESENT");
+	presentPolicy = getPresentPolicy(present ? present : scene.settings.present.c_str());
+	auto mode = std::getenv("TRIANGLE_MODE");
+	buildMode = getBuildMode(mode ? mode : TRIANGLE_MODE);
+	reportLatency = std::getenv("TRIANGLE_LATENCY") != nullptr;
+	reportMemory = std::getenv("TRIANGLE_MEMORY") != nullptr;
+	threadedUpdate = std::getenv("TRIANGLE_SERIAL_UPDATE") == nullptr;
+	pushConstants = std::getenv("TRIANGLE_UNIFORM_OBJECT") == nullptr;
+
+	// The main and update threads both wait on jobs, each gets its own queue
+	auto workers = std::getenv("TRIANGLE_WORKERS");
+	startJobSystem(jobs, workers ? static_cast<uint32_t>(std::strtoul(workers, nullptr, 10)) :
+		std::max(std::thread::hardware_concurrency(), 2u) - 1, 2);
+	auto frames = std::getenv("TRIANGLE_FRAMES");
+	frameLimit = frames ? std::strtoull(frames, nullptr, 10) : scene.settings.frames;
+
+	// Capping defaults to 60 Hz, any policy is paced when a rate is given
+	auto frameRate = std::getenv("TRIANGLE_FRAME_RATE");
+	auto rate = frameRate ? std::strtod(frameRate, nullptr) : scene.settings.frameRate;
+	if (rate <= 0.0 && presentPolicy == PresentPolicy::eFrameCap)
+		rate = 60.0;
+	frameInterval = rate > 0.0 ? std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<double>(1.0 / rate)) : std::chrono::steady_clock::duration::zero();
 
 	glfwInit();
 	glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
@@ -84,9 +681,16 @@ void initializeBase()
 	uint32_t extensionCount = 0;
 	const char** extensionNames = glfwGetRequiredInstanceExtensions(&extensionCount);
 
-	std::vector<const char*> layers{ "VK_LAYER_KHRONOS_validation" };
+	std::vector<const char*> layers;
 	std::vector<const char*> extensions{ extensionNames, extensionNames + extensionCount };
-	extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+	if (buildMode == BuildMode::eDebug)
+		layers.push_back("VK_LAYER_KHRONOS_validation");
+
+	// Labels only need the extension, profiling without layers depends on the loader or driver exposing it
+	debugLabels = buildMode == BuildMode::eDebug ||
+		(buildMode == BuildMode::eProfile && hasInstanceExtension(VK_EXT_DEBUG_UTILS_EXTENSION_NAME));
+	if (debugLabels)
+		extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
 
 	vk::ApplicationInfo applicationInfo{
 		"Triangle",
@@ -98,8 +702,6 @@ void initializeBase()
 
 	vk::DebugUtilsMessengerCreateInfoEXT messengerInfo{
 		vk::DebugUtilsMessengerCreateFlagsEXT(),
-		vk::DebugUtilsMessageSeverityFlagBitsEXT::eVerbose |
-		vk::DebugUtilsMessageSeverityFlagBitsEXT::eInfo |
 		vk::DebugUtilsMessageSeverityFlagBitsEXT::eWarning |
 		vk::DebugUtilsMessageSeverityFlagBitsEXT::eError,
 		vk::DebugUtilsMessageTypeFlagBitsEXT::eGeneral |
@@ -117,51 +719,123 @@ void initializeBase()
 		static_cast<uint32_t>(extensions.size()),
 		extensions.data(),
 	};
-	instanceInfo.setPNext(&messengerInfo);
+	if (buildMode == BuildMode::eDebug)
+		instanceInfo.setPNext(&messengerInfo);
 
 	instance = vk::createInstance(instanceInfo);
 	loader = vk::DispatchLoaderDynamic{ instance, vkGetInstanceProcAddr };
-	messenger = instance.createDebugUtilsMessengerEXT(messengerInfo, nullptr, loader);
+	if (buildMode == BuildMode::eDebug)
+		messenger = instance.createDebugUtilsMessengerEXT(messengerInfo, nullptr, loader);
 	if (!window || glfwCreateWindowSurface(static_cast<VkInstance>(instance), window,
 		NULL, reinterpret_cast<VkSurfaceKHR*>(&surface)) != VK_SUCCESS)
 		throw vk::SurfaceLostKHRError(nullptr);
 
-	deviceIndex = 0;
-	queueIndex = 0;
 	float queuePriority = 1.0f;
 	std::vector<const char*> deviceExtensions{ VK_KHR_SWAPCHAIN_EXTENSION_NAME };
 	vk::PhysicalDeviceFeatures deviceFeatures{};
 	deviceFeatures.fillModeNonSolid = VK_TRUE;
 	deviceFeatures.wideLines = VK_TRUE;
+	deviceFeatures.drawIndirectFirstInstance = VK_TRUE;
+
+	vk::PhysicalDeviceVulkan12Features indexingFeatures{};
+	indexingFeatures.descriptorIndexing = VK_TRUE;
+	indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+	indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+	indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+	indexingFeatures.descriptorBindingVariableDescriptorCount = VK_TRUE;
+	indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+	indexingFeatures.descriptorBindingUpdateUnusedWhilePending = VK_TRUE;
+	indexingFeatures.timelineSemaphore = VK_TRUE;
+
+	pickDevice();
+	chooseQueueFamilies();
+	queryMemoryProperties();
+	reportDevice();
+
+	// Dynamic rendering and state require their feature when exposed, so support is read off the extension
+	// list, the memory budget has no feature at all
+	dynamicRendering = false;
+	extendedDynamicState = false;
+	memoryBudget = false;
+	for (auto& extension : physicalDevice.enumerateDeviceExtensionProperties())
+	{
+		if (std::strcmp(extension.extensionName, VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME) == 0)
+			dynamicRendering = dynamicViewport;
+		if (std::strcmp(extension.extensionName, VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME) == 0)
+			extendedDynamicState = dynamicViewport;
+		if (std::strcmp(extension.extensionName, VK_EXT_MEMORY_BUDGET_EXTENSION_NAME) == 0)
+			memoryBudget = true;
+	}
 
-	vk::DeviceQueueCreateInfo queueInfo{
-		vk::DeviceQueueCreateFlags(),
-		queueIndex,
-		1,
-		&queuePriority
+	vk::PhysicalDeviceDynamicRenderingFeaturesKHR dynamicRenderingFeatures{
+		VK_TRUE
 	};
 
+	vk::PhysicalDeviceExtendedDynamicStateFeaturesEXT extendedDynamicStateFeatures{
+		VK_TRUE
+	};
+
+	if (dynamicRendering)
+	{
+		deviceExtensions.push_back(VK_KHR_DYNAMIC_RENDERING_EXTENSION_NAME);
+		dynamicRenderingFeatures.pNext = indexingFeatures.pNext;
+		indexingFeatures.pNext = &dynamicRenderingFeatures;
+	}
+	if (extendedDynamicState)
+	{
+		deviceExtensions.push_back(VK_EXT_EXTENDED_DYNAMIC_STATE_EXTENSION_NAME);
+		extendedDynamicStateFeatures.pNext = indexingFeatures.pNext;
+		indexingFeatures.pNext = &extendedDynamicStateFeatures;
+	}
+	if (memoryBudget)
+		deviceExtensions.push_back(VK_EXT_MEMORY_BUDGET_EXTENSION_NAME);
+
+	std::vector<vk::DeviceQueueCreateInfo> queueInfos;
+	for (auto family : { queueIndex, transferIndex, computeIndex })
+		if (std::none_of(queueInfos.begin(), queueInfos.end(),
+			[family](const vk::DeviceQueueCreateInfo& info) { return info.queueFamilyIndex == family; }))
+			queueInfos.push_back(vk::DeviceQueueCreateInfo{
+				vk::DeviceQueueCreateFlags(),
+				family,
+				1,
+				&queuePriority
+			});
+
 	vk::DeviceCreateInfo deviceInfo{
 		vk::DeviceCreateFlags(),
-		1,
-		&queueInfo,
+		static_cast<uint32_t>(queueInfos.size()),
+		queueInfos.data(),
 		0,
 		nullptr,
 		static_cast<uint32_t>(deviceExtensions.size()),
 		deviceExtensions.data(),
 		&deviceFeatures
 	};
+	deviceInfo.setPNext(&indexingFeatures);
 
 	vk::CommandPoolCreateInfo commandInfo{
-		vk::CommandPoolCreateFlags(),
+		vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
 		queueIndex
 	};
 
-	physicalDevice = instance.enumeratePhysicalDevices().at(deviceIndex);
-	static_cast<void>(physicalDevice.getQueueFamilyProperties());
+	vk::CommandPoolCreateInfo transferInfo{
+		vk::CommandPoolCreateFlagBits::eTransient,
+		transferIndex
+	};
+
+	vk::CommandPoolCreateInfo computeInfo{
+		vk::CommandPoolCreateFlagBits::eResetCommandBuffer,
+		computeIndex
+	};
+
 	device = physicalDevice.createDevice(deviceInfo);
+	loader.init(device);
 	queue = device.getQueue(queueIndex, 0);
+	transferQueue = device.getQueue(transferIndex, 0);
+	computeQueue = device.getQueue(computeIndex, 0);
 	commandPool = device.createCommandPool(commandInfo);
+	transferPool = device.createCommandPool(transferInfo);
+	computePool = device.createCommandPool(computeInfo);
 }
 
 vk::ImageView createImageView(vk::Image image, uint32_t levels, vk::Format format, vk::ImageAspectFlags flags)
@@ -193,6 +867,51 @@ vk::ImageView createImageView(vk::Image image, uint32_t levels, vk::Format forma
 	return device.createImageView(viewInfo);
 }
 
+// FIFO is the only mode every surface supports, so it ends each policy's preference list
+vk::PresentModeKHR choosePresentMode(const std::vector<vk::PresentModeKHR>& presentModes)
+{
+	std::vector<vk::PresentModeKHR> preferred;
+	switch (presentPolicy)
+	{
+	case PresentPolicy::eBalanced:
+	case PresentPolicy::eLowLatency:
+		preferred = { vk::PresentModeKHR::eMailbox, vk::PresentModeKHR::eImmediate };
+		break;
+	case PresentPolicy::eFrameCap:
+		// A paced frame that misses its interval tears instead of waiting for the next one
+		preferred = { vk::PresentModeKHR::eFifoRelaxed };
+		break;
+	case PresentPolicy::eThroughput:
+		preferred = { vk::PresentModeKHR::eImmediate, vk::PresentModeKHR::eMailbox };
+		break;
+	case PresentPolicy::eVsync:
+		break;
+	}
+
+	for (auto presentMode : preferred)
+		if (std::find(presentModes.begin(), presentModes.end(), presentMode) != presentModes.end())
+			return presentMode;
+
+	return vk::PresentModeKHR::eFifo;
+}
+
+// Mailbox needs a spare image to replace, a vsync queue is kept as short as the surface allows and
+// throughput keeps one more so rendering never waits on the display
+uint32_t chooseImageCount(const vk::SurfaceCapabilitiesKHR& surfaceCapabilities, vk::PresentModeKHR presentMode)
+{
+	auto imageCount = surfaceCapabilities.minImageCount + 1;
+	if (presentMode == vk::PresentModeKHR::eFifo && presentPolicy != PresentPolicy::eThroughput)
+		imageCount = surfaceCapabilities.minImageCount;
+	else if (presentPolicy == PresentPolicy::eThroughput)
+		imageCount = surfaceCapabilities.minImageCount + 2;
+
+	imageCount = std::max(imageCount, 2u);
+	if (surfaceCapabilities.maxImageCount)
+		imageCount = std::min(imageCount, surfaceCapabilities.maxImageCount);
+
+	return imageCount;
+}
+
 void createSwapchain()
 {
 	glfwGetFramebufferSize(window, reinterpret_cast<int*>(&width), reinterpret_cast<int*>(&height));
@@ -214,15 +933,12 @@ void createSwapchain()
 		}
 	};
 
-	bool mailbox = false;
-	for (auto& presentMode : presentModes)
-		if (presentMode == vk::PresentModeKHR::eMailbox)
-			mailbox = true;
+	auto presentMode = choosePresentMode(presentModes);
 
 	vk::SwapchainCreateInfoKHR swapchainInfo{
 		vk::SwapchainCreateFlagsKHR(),
 		surface,
-		surfaceCapabilities.minImageCount + 1,
+		chooseImageCount(surfaceCapabilities, presentMode),
 		swapchainFormat,
 		vk::ColorSpaceKHR::eSrgbNonlinear,
 		swapchainArea.extent,
@@ -233,31 +949,120 @@ void createSwapchain()
 		0,
 		surfaceCapabilities.currentTransform,
 		vk::CompositeAlphaFlagBitsKHR::eOpaque,
-		mailbox ? vk::PresentModeKHR::eMailbox : vk::PresentModeKHR::eImmediate,
+		presentMode,
 		VK_TRUE,
-		nullptr
+		swapchain
 	};
 
+	// The previous swapchain, already retired, hands its resources over instead of being torn down first
 	swapchain = device.createSwapchainKHR(swapchainInfo);
 	swapchainImages = device.getSwapchainImagesKHR(swapchain);
 	swapchainViews.resize(swapchainImages.size());
 	for (uint32_t i = 0; i < swapchainViews.size(); i++)
 		swapchainViews.at(i) = createImageView(swapchainImages.at(i),
 			1, swapchainFormat, vk::ImageAspectFlagBits::eColor);
+	imageValues.assign(swapchainImages.size(), 0);
+}
+
+vk::ImageAspectFlags getDepthAspect(vk::Format format)
+{
+	if (format == vk::Format::eD32SfloatS8Uint || format == vk::Format::eD24UnormS8Uint ||
+		format == vk::Format::eD16UnormS8Uint)
+		return vk::ImageAspectFlagBits::eDepth | vk::ImageAspectFlagBits::eStencil;
+
+	return vk::ImageAspectFlagBits::eDepth;
+}
+
+void chooseDepthFormat()
+{
+	// Reverse-Z keeps most of its precision only with a floating point depth buffer
+	std::array<vk::Format, 4> candidates{
+		vk::Format::eD32Sfloat,
+		vk::Format::eD32SfloatS8Uint,
+		vk::Format::eD24UnormS8Uint,
+		vk::Format::eD16Unorm
+	};
+
+	for (auto& candidate : candidates)
+	{
+		auto properties = physicalDevice.getFormatProperties(candidate);
+
+		if (properties.optimalTilingFeatures & vk::FormatFeatureFlagBits::eDepthStencilAttachment)
+		{
+			depthFormat = candidate;
+			return;
+		}
+	}
+
+	throw vk::FormatNotSupportedError("No supported depth format");
+}
+
+// Highest count color and depth both support up to the request, a single sample renders straight into the swapchain
+void chooseSampleCount()
+{
+	auto requested = std::getenv("TRIANGLE_SAMPLES");
+	auto samples = requested ? static_cast<uint32_t>(std::strtoul(requested, nullptr, 10)) : scene.settings.samples;
+	auto limits = physicalDevice.getProperties().limits;
+	auto supported = limits.framebufferColorSampleCounts & limits.framebufferDepthSampleCounts;
+
+	sampleCount = vk::SampleCountFlagBits::e1;
+	for (uint32_t count = 2; count <= samples && count <= 64; count *= 2)
+		if (supported & static_cast<vk::SampleCountFlagBits>(count))
+			sampleCount = static_cast<vk::SampleCountFlagBits>(count);
 }
 
 void createRenderPass()
 {
+	if (dynamicRendering)
+		return;
+
+	bool multisampled = sampleCount != vk::SampleCountFlagBits::e1;
+
 	vk::AttachmentReference colorReference{
 		0,
 		vk::ImageLayout::eColorAttachmentOptimal
 	};
 
+	vk::AttachmentReference depthReference{
+		1,
+		vk::ImageLayout::eDepthStencilAttachmentOptimal
+	};
+
+	vk::AttachmentReference resolveReference{
+		2,
+		vk::ImageLayout::eColorAttachmentOptimal
+	};
+
+	// Multisampled color never leaves tile memory, only the resolve into the swapchain image is written out
 	vk::AttachmentDescription colorAttachment{
 		vk::AttachmentDescriptionFlags(),
 		swapchainFormat,
-		vk::SampleCountFlagBits::e1,
+		sampleCount,
 		vk::AttachmentLoadOp::eClear,
+		multisampled ? vk::AttachmentStoreOp::eDontCare : vk::AttachmentStoreOp::eStore,
+		vk::AttachmentLoadOp::eDontCare,
+		vk::AttachmentStoreOp::eDontCare,
+		vk::ImageLayout::eUndefined,
+		multisampled ? vk::ImageLayout::eColorAttachmentOptimal : vk::ImageLayout::ePresentSrcKHR
+	};
+
+	vk::AttachmentDescription depthAttachment{
+		vk::AttachmentDescriptionFlags(),
+		depthFormat,
+		sampleCount,
+		vk::AttachmentLoadOp::eClear,
+		vk::AttachmentStoreOp::eDontCare,
+		vk::AttachmentLoadOp::eDontCare,
+		vk::AttachmentStoreOp::eDontCare,
+		vk::ImageLayout::eUndefined,
+		vk::ImageLayout::eDepthStencilAttachmentOptimal
+	};
+
+	vk::AttachmentDescription resolveAttachment{
+		vk::AttachmentDescriptionFlags(),
+		swapchainFormat,
+		vk::SampleCountFlagBits::e1,
+		vk::AttachmentLoadOp::eDontCare,
 		vk::AttachmentStoreOp::eStore,
 		vk::AttachmentLoadOp::eDontCare,
 		vk::AttachmentStoreOp::eDontCare,
@@ -265,107 +1070,402 @@ void createRenderPass()
 		vk::ImageLayout::ePresentSrcKHR
 	};
 
-	vk::SubpassDescription subpass{
+	std::vector<vk::AttachmentDescription> attachments{
+		colorAttachment,
+		depthAttachment
+	};
+	if (multisampled)
+		attachments.push_back(resolveAttachment);
+
+	vk::SubpassDescription prepassSubpass{
 		vk::SubpassDescriptionFlags(),
 		vk::PipelineBindPoint::eGraphics,
 		0,
 		nullptr,
-		1,
-		&colorReference,
+		0,
 		nullptr,
 		nullptr,
+		&depthReference,
 		0,
 		nullptr
 	};
 
-	vk::SubpassDependency dependency{
-		VK_SUBPASS_EXTERNAL,
+	vk::SubpassDescription mainSubpass{
+		vk::SubpassDescriptionFlags(),
+		vk::PipelineBindPoint::eGraphics,
 		0,
-		vk::PipelineStageFlagBits::eColorAttachmentOutput,
-		vk::PipelineStageFlagBits::eColorAttachmentOutput,
-		vk::AccessFlags(),
-		vk::AccessFlagBits::eColorAttachmentRead |
-		vk::AccessFlagBits::eColorAttachmentWrite,
-		vk::DependencyFlags()
+		nullptr,
+		1,
+		&colorReference,
+		multisampled ? &resolveReference : nullptr,
+		&depthReference,
+		0,
+		nullptr
+	};
+
+	std::vector<vk::SubpassDescription> subpasses;
+	if (depthPrepass)
+		subpasses.push_back(prepassSubpass);
+	subpasses.push_back(mainSubpass);
+
+	// Depth and the multisampled color image are shared by every frame in flight, the previous frame's
+	// writes and resolve have to land before this one clears them
+	std::vector<vk::SubpassDependency> dependencies{
+		vk::SubpassDependency{
+			VK_SUBPASS_EXTERNAL,
+			0,
+			vk::PipelineStageFlagBits::eColorAttachmentOutput |
+			vk::PipelineStageFlagBits::eLateFragmentTests,
+			vk::PipelineStageFlagBits::eColorAttachmentOutput |
+			vk::PipelineStageFlagBits::eEarlyFragmentTests,
+			vk::AccessFlagBits::eColorAttachmentWrite |
+			vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+			vk::AccessFlagBits::eColorAttachmentRead |
+			vk::AccessFlagBits::eColorAttachmentWrite |
+			vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+			vk::DependencyFlags()
+		}
 	};
 
+	if (depthPrepass)
+		dependencies.push_back(vk::SubpassDependency{
+			0,
+			1,
+			vk::PipelineStageFlagBits::eLateFragmentTests,
+			vk::PipelineStageFlagBits::eEarlyFragmentTests,
+			vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+			vk::AccessFlagBits::eDepthStencilAttachmentRead,
+			vk::DependencyFlagBits::eByRegion
+		});
+
 	vk::RenderPassCreateInfo renderPassInfo{
 		vk::RenderPassCreateFlags(),
-		1,
-		&colorAttachment,
-		1,
-		&subpass,
-		1,
-		&dependency
+		static_cast<uint32_t>(attachments.size()),
+		attachments.data(),
+		static_cast<uint32_t>(subpasses.size()),
+		subpasses.data(),
+		static_cast<uint32_t>(dependencies.size()),
+		dependencies.data()
 	};
 
 	renderPass = device.createRenderPass(renderPassInfo);
 }
 
-vk::ShaderModule loadShader(std::string path)
+vk::ShaderModule createShaderModule(const uint32_t* code, size_t size)
 {
-	std::ifstream file(path, std::ios::binary | std::ios::ate);
-	auto size = file.tellg();
-	file.seekg(0, std::ios::beg);
-	std::vector<uint32_t> data(size / sizeof(uint32_t));
-	file.read(reinterpret_cast<char*>(data.data()), size);
-
 	vk::ShaderModuleCreateInfo shaderInfo{
 		vk::ShaderModuleCreateFlags(),
-		static_cast<size_t>(size),
-		data.data()
+		size,
+		code
 	};
 
 	return device.createShaderModule(shaderInfo);
 }
 
-void createShaderModules()
+vk::ShaderModule createShaderModule(const std::vector<uint32_t>& code)
 {
-	vertexShader = loadShader("shaders/vert.spv");
-	fragmentShader = loadShader("shaders/frag.spv");
+	auto binary = validateShaderBinary(reinterpret_cast<const uint8_t*>(code.data()),
+		code.size() * sizeof(uint32_t), "compiled shader");
+	return createShaderModule(binary.code, binary.size);
 }
 
-void createDescriptorSetLayout()
+vk::ShaderModule loadShader(std::string path, ShaderReflection& reflection)
 {
-	vk::DescriptorSetLayoutBinding uniformBinding{
-		0,
-		vk::DescriptorType::eUniformBuffer,
-		1,
-		vk::ShaderStageFlagBits::eVertex
-	};
+	auto file = openShaderFile(path);
+
+	try {
+		auto binary = validateShaderBinary(file.data, file.size, path);
+		reflection = reflectShader(binary.code, binary.size);
+		auto shader = createShaderModule(binary.code, binary.size);
+		closeShaderFile(file);
+		return shader;
+	}
+	catch (...) {
+		closeShaderFile(file);
+		throw;
+	}
+}
 
-	vk::DescriptorSetLayoutCreateInfo layoutInfo{
-		vk::DescriptorSetLayoutCreateFlags(),
-		1,
-		&uniformBinding
-	};
+ShaderReflection reflectPipeline()
+{
+	ShaderReflection reflection;
+	mergeReflection(reflection, vertexReflection);
+	mergeReflection(reflection, fragmentReflection);
+	return reflection;
+}
 
-	descriptorSetLayout = device.createDescriptorSetLayout(layoutInfo);
+// Per-draw data goes through push constants unless the range the pipeline layout needs outgrows the device
+bool fitsPushConstants()
+{
+	return reflectPipeline().pushConstantSize <= physicalDevice.getProperties().limits.maxPushConstantsSize;
 }
 
-void createGraphicsPipeline()
+void createShaderModules()
 {
-	vk::VertexInputBindingDescription bindingDescription{
-		0,
-		sizeof(Vertex),
-		vk::VertexInputRate::eVertex
-	};
+	auto& directory = scene.settings.shaders;
 
-	std::array<vk::VertexInputAttributeDescription, 2> attributeDescriptions{
-		vk::VertexInputAttributeDescription{
-			0,
-			0,
-			vk::Format::eR32G32B32Sfloat,
-			0
-		},
-		vk::VertexInputAttributeDescription{
-			1,
-			0,
-			vk::Format::eR32G32B32Sfloat,
-			sizeof(glm::vec3)
+	// The archive built by make maps every module at once, loose binaries are the fallback
+	if (std::ifstream(directory + "/shaders.pak").good())
+	{
+		auto pack = openShaderPack(directory + "/shaders.pak");
+		try {
+			auto vertexBinary = &findShaderBinary(pack, pushConstants ? "vert.spv" : "vert_ubo.spv");
+			auto& fragmentBinary = findShaderBinary(pack, "frag.spv");
+			auto& cullBinary = findShaderBinary(pack, "cull.spv");
+			cullReflection = reflectShader(cullBinary.code, cullBinary.size);
+			cullShader = createShaderModule(cullBinary.code, cullBinary.size);
+			vertexReflection = reflectShader(vertexBinary->code, vertexBinary->size);
+			fragmentReflection = reflectShader(fragmentBinary.code, fragmentBinary.size);
+			if (pushConstants && !fitsPushConstants())
+			{
+				pushConstants = false;
+				vertexBinary = &findShaderBinary(pack, "vert_ubo.spv");
+				vertexReflection = reflectShader(vertexBinary->code, vertexBinary->size);
+			}
+			vertexShader = createShaderModule(vertexBinary->code, vertexBinary->size);
+			fragmentShader = createShaderModule(fragmentBinary.code, fragmentBinary.size);
+		}
+		catch (...) {
+			closeShaderFile(pack.file);
+			throw;
+		}
+		closeShaderFile(pack.file);
+	}
+	else
+	{
+		vertexShader = loadShader(directory + (pushConstants ? "/vert.spv" : "/vert_ubo.spv"), vertexReflection);
+		fragmentShader = loadShader(directory + "/frag.spv", fragmentReflection);
+		cullShader = loadShader(directory + "/cull.spv", cullReflection);
+		if (pushConstants && !fitsPushConstants())
+		{
+			pushConstants = false;
+			device.destroyShaderModule(vertexShader, nullptr);
+			vertexShader = loadShader(directory + "/vert_ubo.spv", vertexReflection);
+		}
+	}
+
+	// Startup uses the binaries from make, the watcher only compiles what changes afterwards
+	if (hotReload)
+	{
+		initializeShaderCompiler(shaderCompiler, directory);
+		vertexVariant = addShaderVariant(shaderCompiler, directory + "/shader.vert",
+			pushConstants ? std::vector<std::string>{} : std::vector<std::string>{ "UNIFORM_OBJECT" });
+		fragmentVariant = addShaderVariant(shaderCompiler, directory + "/shader.frag", {});
+		startShaderWatcher(shaderCompiler);
+	}
+}
+
+vk::DescriptorSetLayout getDescriptorSetLayout(const ShaderReflection& reflection, uint32_t set)
+{
+	std::vector<vk::DescriptorSetLayoutBinding> bindings;
+	std::vector<vk::DescriptorBindingFlags> bindingFlags;
+	std::vector<uint32_t> key;
+	bool updateAfterBind = false;
+
+	// Runtime arrays are the bindless tables, they get the texture limit and may be written while in use
+	for (auto& reflected : reflection.bindings)
+	{
+		if (reflected.set != set)
+			continue;
+
+		bindings.push_back(vk::DescriptorSetLayoutBinding{
+			reflected.binding,
+			reflected.type,
+			reflected.runtimeArray ? textureLimit : reflected.count,
+			reflected.stages
+		});
+
+		bindingFlags.push_back(reflected.runtimeArray ?
+			vk::DescriptorBindingFlagBits::ePartiallyBound |
+			vk::DescriptorBindingFlagBits::eVariableDescriptorCount |
+			vk::DescriptorBindingFlagBits::eUpdateAfterBind |
+			vk::DescriptorBindingFlagBits::eUpdateUnusedWhilePending :
+			vk::DescriptorBindingFlags());
+
+		updateAfterBind |= reflected.runtimeArray;
+		key.insert(key.end(), {
+			reflected.binding,
+			static_cast<uint32_t>(reflected.type),
+			bindings.back().descriptorCount,
+			static_cast<VkShaderStageFlags>(reflected.stages),
+			static_cast<VkDescriptorBindingFlags>(bindingFlags.back())
+		});
+	}
+
+	auto cached = setLayoutCache.find(key);
+	if (cached != setLayoutCache.end())
+		return cached->second;
+
+	vk::DescriptorSetLayoutBindingFlagsCreateInfo bindingFlagsInfo{
+		static_cast<uint32_t>(bindingFlags.size()),
+		bindingFlags.data()
+	};
+
+	vk::DescriptorSetLayoutCreateInfo layoutInfo{
+		updateAfterBind ? vk::DescriptorSetLayoutCreateFlagBits::eUpdateAfterBindPool :
+			vk::DescriptorSetLayoutCreateFlags(),
+		static_cast<uint32_t>(bindings.size()),
+		bindings.data()
+	};
+	layoutInfo.setPNext(&bindingFlagsInfo);
+
+	return setLayoutCache[key] = device.createDescriptorSetLayout(layoutInfo);
+}
+
+vk::PipelineLayout getPipelineLayout(const std::vector<vk::DescriptorSetLayout>& setLayouts,
+	const ShaderReflection& reflection)
+{
+	std::vector<uint64_t> key{
+		static_cast<VkShaderStageFlags>(reflection.pushConstantStages),
+		reflection.pushConstantSize
+	};
+	for (auto& setLayout : setLayouts)
+		key.push_back(reinterpret_cast<uint64_t>(static_cast<VkDescriptorSetLayout>(setLayout)));
+
+	auto cached = pipelineLayoutCache.find(key);
+	if (cached != pipelineLayoutCache.end())
+		return cached->second;
+
+	vk::PushConstantRange pushConstantRange{
+		reflection.pushConstantStages,
+		0,
+		reflection.pushConstantSize
+	};
+
+	vk::PipelineLayoutCreateInfo pipelineLayoutInfo{
+		vk::PipelineLayoutCreateFlags(),
+		static_cast<uint32_t>(setLayouts.size()),
+		setLayouts.data(),
+		reflection.pushConstantSize ? 1u : 0u,
+		reflection.pushConstantSize ? &pushConstantRange : nullptr
+	};
+
+	return pipelineLayoutCache[key] = device.createPipelineLayout(pipelineLayoutInfo);
+}
+
+void createDescriptorSetLayout()
+{
+	auto indexingProperties = physicalDevice.getProperties2<vk::PhysicalDeviceProperties2,
+		vk::PhysicalDeviceDescriptorIndexingProperties>().get<vk::PhysicalDeviceDescriptorIndexingProperties>();
+
+	materialLimit = 1024;
+	// Combined image samplers count as both a sampled image and a sampler, per stage and per set
+	textureLimit = std::min({ 4096u, indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages,
+		indexingProperties.maxDescriptorSetUpdateAfterBindSampledImages,
+		indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers,
+		indexingProperties.maxDescriptorSetUpdateAfterBindSamplers });
+
+	// Bindings come from the shaders, set 0 is per image data and set 1 the bindless tables
+	auto reflection = reflectPipeline();
+	descriptorSetLayout = getDescriptorSetLayout(reflection, 0);
+	bindlessSetLayout = getDescriptorSetLayout(reflection, 1);
+}
+
+void createPipelineLayout()
+{
+	pipelineLayout = getPipelineLayout({ descriptorSetLayout, bindlessSetLayout }, reflectPipeline());
+}
+
+void createComputePipeline()
+{
+	cullSetLayout = getDescriptorSetLayout(cullReflection, 0);
+	cullPipelineLayout = getPipelineLayout({ cullSetLayout }, cullReflection);
+
+	vk::ComputePipelineCreateInfo pipelineInfo{
+		vk::PipelineCreateFlags(),
+		vk::PipelineShaderStageCreateInfo{
+			vk::PipelineShaderStageCreateFlags(),
+			vk::ShaderStageFlagBits::eCompute,
+			cullShader,
+			"main",
+			nullptr
 		},
+		cullPipelineLayout,
+		nullptr,
+		0
+	};
+
+	cullPipeline = device.createComputePipeline(pipelineCache, pipelineInfo).value;
+}
+
+size_t PipelineStateHash::operator()(const PipelineState& state) const
+{
+	uint64_t hash = 0xCBF29CE484222325ull;
+	auto combine = [&hash](uint64_t value) {
+		hash ^= value + 0x9E3779B97F4A7C15ull + (hash << 6) + (hash >> 2);
+	};
+
+	combine(reinterpret_cast<uint64_t>(static_cast<VkShaderModule>(state.vertexShader)));
+	combine(reinterpret_cast<uint64_t>(static_cast<VkShaderModule>(state.fragmentShader)));
+	combine(reinterpret_cast<uint64_t>(static_cast<VkPipelineLayout>(state.layout)));
+	combine(reinterpret_cast<uint64_t>(static_cast<VkRenderPass>(state.renderPass)));
+	combine(state.subpass);
+	combine(static_cast<uint64_t>(state.colorFormat));
+	combine(static_cast<uint64_t>(state.depthFormat));
+	combine(static_cast<uint64_t>(state.samples));
+	combine(state.extent.width);
+	combine(state.extent.height);
+	combine(state.vertexStride);
+	combine(static_cast<uint64_t>(state.topology));
+	combine(static_cast<uint64_t>(state.polygonMode));
+	combine(static_cast<VkCullModeFlags>(state.cullMode));
+	combine(static_cast<uint64_t>(state.frontFace));
+	combine(state.depthWrite);
+	combine(static_cast<uint64_t>(state.depthCompare));
+	combine(state.blend);
+	for (auto constant : state.constants)
+		combine(constant);
+
+	return static_cast<size_t>(hash);
+}
+
+bool PipelineState::operator==(const PipelineState& other) const
+{
+	return vertexShader == other.vertexShader && fragmentShader == other.fragmentShader &&
+		layout == other.layout && renderPass == other.renderPass && subpass == other.subpass &&
+		colorFormat == other.colorFormat && depthFormat == other.depthFormat && samples == other.samples &&
+		extent == other.extent && vertexStride == other.vertexStride && topology == other.topology &&
+		polygonMode == other.polygonMode && cullMode == other.cullMode && frontFace == other.frontFace &&
+		depthWrite == other.depthWrite && depthCompare == other.depthCompare && blend == other.blend &&
+		constants == other.constants;
+}
+
+vk::Pipeline createPipeline(const PipelineState& state, const std::vector<ReflectedInput>& inputs)
+{
+	vk::VertexInputBindingDescription bindingDescription{
+		0,
+		state.vertexStride,
+		vk::VertexInputRate::eVertex
 	};
 
+	// Vertex only says which member feeds each location, which locations exist and their formats come from
+	// the shader. An input that does not read exactly one member means the two went out of sync
+	struct VertexMember
+	{
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	std::array<VertexMember, 3> vertexMembers{
+		VertexMember{ offsetof(Vertex, pos), sizeof(Vertex::pos) },
+		VertexMember{ offsetof(Vertex, col), sizeof(Vertex::col) },
+		VertexMember{ offsetof(Vertex, tex), sizeof(Vertex::tex) }
+	};
+
+	std::vector<vk::VertexInputAttributeDescription> attributeDescriptions;
+	for (auto& input : inputs)
+	{
+		if (input.location >= vertexMembers.size() || input.size != vertexMembers.at(input.location).size)
+			throw std::runtime_error("Vertex input " + std::to_string(input.location) + " has no matching Vertex member");
+
+		attributeDescriptions.push_back(vk::VertexInputAttributeDescription{
+			input.location,
+			0,
+			input.format,
+			vertexMembers.at(input.location).offset
+		});
+	}
+
 	vk::PipelineVertexInputStateCreateInfo vertexInputInfo{
 		vk::PipelineVertexInputStateCreateFlags(),
 		1,
@@ -376,34 +1476,63 @@ void createGraphicsPipeline()
 
 	vk::PipelineInputAssemblyStateCreateInfo inputAssemblyInfo{
 		vk::PipelineInputAssemblyStateCreateFlags(),
-		vk::PrimitiveTopology::eTriangleList,
+		state.topology,
 		VK_FALSE
 	};
 
 	vk::Viewport viewport{
 		0.0f,
 		0.0f,
-		static_cast<float>(width),
-		static_cast<float>(height),
+		static_cast<float>(state.extent.width),
+		static_cast<float>(state.extent.height),
 		0.0f,
 		1.0f
 	};
 
+	vk::Rect2D scissor{
+		vk::Offset2D{
+			0,
+			0
+		},
+		state.extent
+	};
+
+	std::vector<vk::DynamicState> dynamicStates;
+	if (dynamicViewport)
+		dynamicStates.insert(dynamicStates.end(), {
+			vk::DynamicState::eViewport,
+			vk::DynamicState::eScissor
+		});
+	if (extendedDynamicState)
+		dynamicStates.insert(dynamicStates.end(), {
+			vk::DynamicState::eCullModeEXT,
+			vk::DynamicState::eFrontFaceEXT,
+			vk::DynamicState::ePrimitiveTopologyEXT,
+			vk::DynamicState::eDepthWriteEnableEXT,
+			vk::DynamicState::eDepthCompareOpEXT
+		});
+
+	vk::PipelineDynamicStateCreateInfo dynamicInfo{
+		vk::PipelineDynamicStateCreateFlags(),
+		static_cast<uint32_t>(dynamicStates.size()),
+		dynamicStates.data()
+	};
+
 	vk::PipelineViewportStateCreateInfo viewportInfo{
 		vk::PipelineViewportStateCreateFlags(),
 		1,
 		&viewport,
 		1,
-		&swapchainArea
+		&scissor
 	};
 
 	vk::PipelineRasterizationStateCreateInfo rasterizerInfo{
 		vk::PipelineRasterizationStateCreateFlags(),
 		VK_FALSE,
 		VK_FALSE,
-		vk::PolygonMode::eLine,
-		vk::CullModeFlagBits::eBack,
-		vk::FrontFace::eClockwise,
+		state.polygonMode,
+		state.cullMode,
+		state.frontFace,
 		VK_FALSE,
 		0.0f,
 		0.0f,
@@ -413,7 +1542,7 @@ void createGraphicsPipeline()
 
 	vk::PipelineMultisampleStateCreateInfo multisamplingInfo{
 		vk::PipelineMultisampleStateCreateFlags(),
-		vk::SampleCountFlagBits::e1,
+		state.samples,
 		VK_FALSE,
 		0.0f,
 		nullptr,
@@ -421,13 +1550,26 @@ void createGraphicsPipeline()
 		VK_FALSE
 	};
 
-	vk::PipelineColorBlendAttachmentState colorBlending{
+	vk::PipelineDepthStencilStateCreateInfo depthStencilInfo{
+		vk::PipelineDepthStencilStateCreateFlags(),
+		VK_TRUE,
+		state.depthWrite,
+		state.depthCompare,
 		VK_FALSE,
-		vk::BlendFactor::eZero,
-		vk::BlendFactor::eOne,
+		VK_FALSE,
+		vk::StencilOpState(),
+		vk::StencilOpState(),
+		0.0f,
+		1.0f
+	};
+
+	vk::PipelineColorBlendAttachmentState colorBlending{
+		state.blend,
+		vk::BlendFactor::eSrcAlpha,
+		vk::BlendFactor::eOneMinusSrcAlpha,
 		vk::BlendOp::eAdd,
-		vk::BlendFactor::eZero,
 		vk::BlendFactor::eOne,
+		vk::BlendFactor::eZero,
 		vk::BlendOp::eAdd,
 		vk::ColorComponentFlagBits::eR |
 		vk::ColorComponentFlagBits::eG |
@@ -449,30 +1591,36 @@ void createGraphicsPipeline()
 		}
 	};
 
-	vk::PipelineLayoutCreateInfo pipelineLayoutInfo{
-		vk::PipelineLayoutCreateFlags(),
-		1,
-		&descriptorSetLayout,
-		0,
-		nullptr
+	// Constant i lives at constant_id i, ids a stage does not declare are ignored by the driver
+	std::vector<vk::SpecializationMapEntry> constantEntries;
+	for (uint32_t i = 0; i < state.constants.size(); i++)
+		constantEntries.push_back(vk::SpecializationMapEntry{
+			i,
+			i * static_cast<uint32_t>(sizeof(uint32_t)),
+			sizeof(uint32_t)
+		});
+
+	vk::SpecializationInfo specializationInfo{
+		static_cast<uint32_t>(constantEntries.size()),
+		constantEntries.data(),
+		state.constants.size() * sizeof(uint32_t),
+		state.constants.data()
 	};
 
-	pipelineLayout = device.createPipelineLayout(pipelineLayoutInfo);
-
 	vk::PipelineShaderStageCreateInfo vertexInfo{
 		vk::PipelineShaderStageCreateFlags(),
 		vk::ShaderStageFlagBits::eVertex,
-		vertexShader,
+		state.vertexShader,
 		"main",
-		nullptr
+		&specializationInfo
 	};
 
 	vk::PipelineShaderStageCreateInfo fragmentInfo{
 		vk::PipelineShaderStageCreateFlags(),
 		vk::ShaderStageFlagBits::eFragment,
-		fragmentShader,
+		state.fragmentShader,
 		"main",
-		nullptr
+		&specializationInfo
 	};
 
 	std::array<vk::PipelineShaderStageCreateInfo, 2> shaderStages{
@@ -480,9 +1628,10 @@ void createGraphicsPipeline()
 		fragmentInfo
 	};
 
+	// Depth-only pipelines have no fragment stage and render into subpasses without color attachments
 	vk::GraphicsPipelineCreateInfo graphicsPipelineInfo{
 		vk::PipelineCreateFlags(),
-		static_cast<uint32_t>(shaderStages.size()),
+		state.fragmentShader ? 2u : 1u,
 		shaderStages.data(),
 		&vertexInputInfo,
 		&inputAssemblyInfo,
@@ -490,30 +1639,293 @@ void createGraphicsPipeline()
 		&viewportInfo,
 		&rasterizerInfo,
 		&multisamplingInfo,
+		&depthStencilInfo,
+		state.fragmentShader ? &colorBlendInfo : nullptr,
+		&dynamicInfo,
+		state.layout,
+		state.renderPass,
+		state.subpass,
 		nullptr,
-		&colorBlendInfo,
+		0
+	};
+
+	// Without a render pass the attachment formats are declared on the pipeline itself
+	vk::PipelineRenderingCreateInfoKHR renderingInfo{
+		0,
+		state.colorFormat == vk::Format::eUndefined ? 0u : 1u,
+		&state.colorFormat,
+		state.depthFormat,
+		vk::Format::eUndefined
+	};
+	if (!state.renderPass)
+		graphicsPipelineInfo.setPNext(&renderingInfo);
+
+	return device.createGraphicsPipeline(pipelineCache, graphicsPipelineInfo).value;
+}
+
+void compilePipelines()
+{
+	std::unique_lock<std::mutex> lock(pipelineMutex);
+
+	while (true)
+	{
+		pipelineSignal.wait(lock, []() { return !pipelineRunning || !pipelineJobs.empty(); });
+		if (!pipelineRunning)
+			return;
+
+		auto job = std::move(pipelineJobs.front());
+		pipelineJobs.pop_front();
+		pipelineBusy++;
+
+		lock.unlock();
+		vk::Pipeline compiled;
+		bool failed = false;
+		try {
+			compiled = createPipeline(job.state, job.inputs);
+		}
+		catch (const std::exception& error) {
+			std::cerr << "Pipeline compile failed, keeping the fallback: " << error.what() << '\n';
+			failed = true;
+		}
+		lock.lock();
+
+		pipelineBusy--;
+		pipelineFailures += failed;
+		auto entry = pipelineRegistry.find(job.state);
+		if (entry != pipelineRegistry.end())
+			entry->second = PipelineEntry{
+				compiled,
+				true,
+				failed
+			};
+		else if (compiled)
+			// Cancelled while compiling, nothing can have recorded it yet
+			device.destroyPipeline(compiled, nullptr);
+		pipelineIdle.notify_all();
+	}
+}
+
+void createPipelineCache()
+{
+	std::vector<char> cacheData;
+	std::ifstream file("pipeline.cache", std::ios::binary);
+	if (file.good())
+		cacheData.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+
+	// The driver checks the header itself and starts empty when the data came from another device or driver
+	vk::PipelineCacheCreateInfo cacheInfo{
+		vk::PipelineCacheCreateFlags(),
+		cacheData.size(),
+		cacheData.data()
+	};
+
+	pipelineCache = device.createPipelineCache(cacheInfo);
+
+	// One core stays with the render loop
+	auto cores = std::thread::hardware_concurrency();
+	auto workerCount = cores > 2 ? std::min(cores - 1, 4u) : 1u;
+
+	pipelineRunning = true;
+	for (uint32_t i = 0; i < workerCount; i++)
+		pipelineWorkers.emplace_back(compilePipelines);
+}
+
+void destroyPipelineCache()
+{
+	{
+		std::lock_guard<std::mutex> lock(pipelineMutex);
+		pipelineRunning = false;
+	}
+	pipelineSignal.notify_all();
+	for (auto& worker : pipelineWorkers)
+		worker.join();
+	pipelineWorkers.clear();
+
+	auto cacheData = device.getPipelineCacheData(pipelineCache);
+	std::ofstream("pipeline.cache", std::ios::binary).write(reinterpret_cast<const char*>(cacheData.data()),
+		cacheData.size());
+	device.destroyPipelineCache(pipelineCache, nullptr);
+}
+
+// Dynamic fields are pinned to fixed values, so every variant of them shares one pipeline
+PipelineState getPipelineKey(PipelineState state)
+{
+	if (dynamicViewport)
+		state.extent = vk::Extent2D();
+	if (extendedDynamicState)
+	{
+		state.topology = vk::PrimitiveTopology::eTriangleList;
+		state.cullMode = vk::CullModeFlagBits::eNone;
+		state.frontFace = vk::FrontFace::eCounterClockwise;
+		state.depthWrite = VK_FALSE;
+		state.depthCompare = vk::CompareOp::eNever;
+	}
+	return state;
+}
+
+// Returns the pipeline for a state, or a null handle while a worker is still compiling it. Waiting
+// compiles on the calling thread instead, for the few pipelines a frame cannot go without
+vk::Pipeline requestPipeline(const PipelineState& requested, bool wait)
+{
+	auto state = getPipelineKey(requested);
+	std::unique_lock<std::mutex> lock(pipelineMutex);
+
+	pipelineLookups++;
+	auto entry = pipelineRegistry.find(state);
+	if (entry != pipelineRegistry.end())
+	{
+		auto& pending = entry->second;
+		if (wait)
+			pipelineIdle.wait(lock, [&pending]() { return pending.ready; });
+		return pending.pipeline;
+	}
+
+	pipelineCompiles++;
+	if (wait)
+	{
+		lock.unlock();
+		auto compiled = createPipeline(state, vertexReflection.inputs);
+		lock.lock();
+
+		pipelineRegistry.emplace(state, PipelineEntry{
+			compiled,
+			true,
+			false
+		});
+		return compiled;
+	}
+
+	pipelineRegistry.emplace(state, PipelineEntry{
 		nullptr,
+		false,
+		false
+	});
+	pipelineJobs.push_back(PipelineJob{
+		state,
+		vertexReflection.inputs
+	});
+	pipelineSignal.notify_one();
+
+	return nullptr;
+}
+
+// Drops queued work and waits out running compiles, so render passes and modules can be destroyed
+void cancelPipelines(std::unique_lock<std::mutex>& lock)
+{
+	pipelineJobs.clear();
+	for (auto entry = pipelineRegistry.begin(); entry != pipelineRegistry.end();)
+	{
+		if (!entry->second.ready)
+			entry = pipelineRegistry.erase(entry);
+		else
+			entry++;
+	}
+
+	pipelineIdle.wait(lock, []() { return pipelineBusy == 0; });
+}
+
+void retirePipelines(vk::ShaderModule shader)
+{
+	std::unique_lock<std::mutex> lock(pipelineMutex);
+	cancelPipelines(lock);
+
+	// A destroyed module handle can be handed out again, so its entries must leave the registry with it
+	for (auto entry = pipelineRegistry.begin(); entry != pipelineRegistry.end();)
+	{
+		if (entry->first.vertexShader == shader || entry->first.fragmentShader == shader)
+		{
+			retireResource(entry->second.pipeline);
+			entry = pipelineRegistry.erase(entry);
+		}
+		else
+			entry++;
+	}
+}
+
+void retireAllPipelines()
+{
+	std::unique_lock<std::mutex> lock(pipelineMutex);
+	cancelPipelines(lock);
+
+	for (auto& entry : pipelineRegistry)
+		retireResource(entry.second.pipeline);
+	pipelineRegistry.clear();
+}
+
+PipelineState getMainPipelineState()
+{
+	// Reverse-Z: near plane maps to 1.0 and the depth buffer is cleared to 0.0. With a pre-pass the main
+	// pass only shades the fragments that survived it, so it tests for equality and leaves depth untouched
+	return PipelineState{
+		vertexShader,
+		fragmentShader,
 		pipelineLayout,
 		renderPass,
-		0,
-		nullptr,
-		0
+		depthPrepass && !dynamicRendering ? 1u : 0u,
+		swapchainFormat,
+		depthFormat,
+		sampleCount,
+		swapchainArea.extent,
+		sizeof(Vertex),
+		vk::PrimitiveTopology::eTriangleList,
+		vk::PolygonMode::eLine,
+		vk::CullModeFlagBits::eBack,
+		vk::FrontFace::eClockwise,
+		depthPrepass ? VK_FALSE : VK_TRUE,
+		depthPrepass ? vk::CompareOp::eEqual : vk::CompareOp::eGreater,
+		VK_FALSE,
+		{ VK_TRUE }
 	};
+}
 
-	pipeline = device.createGraphicsPipeline(nullptr, graphicsPipelineInfo).value;
+void createGraphicsPipeline()
+{
+	mainState = getMainPipelineState();
+
+	// Untextured and testing depth on its own, so it stands in whether or not the pre-pass is ready
+	fallbackState = mainState;
+	fallbackState.depthWrite = VK_TRUE;
+	fallbackState.depthCompare = vk::CompareOp::eGreaterOrEqual;
+	fallbackState.constants = { VK_FALSE };
+
+	prepassState = mainState;
+	prepassState.fragmentShader = nullptr;
+	prepassState.subpass = 0;
+	prepassState.colorFormat = vk::Format::eUndefined;
+	prepassState.depthWrite = VK_TRUE;
+	prepassState.depthCompare = vk::CompareOp::eGreater;
+	prepassState.constants.clear();
+
+	// Only the fallback blocks, everything else streams in from the workers
+	static_cast<void>(requestPipeline(fallbackState, true));
+	static_cast<void>(requestPipeline(mainState, false));
+	if (depthPrepass)
+		static_cast<void>(requestPipeline(prepassState, false));
 }
 
 void createFramebuffers()
 {
+	if (dynamicRendering)
+		return;
+
 	framebuffers.resize(swapchainViews.size());
 
+	bool multisampled = sampleCount != vk::SampleCountFlagBits::e1;
+
 	for (uint32_t i = 0; i < framebuffers.size(); i++)
 	{
+		std::vector<vk::ImageView> attachments{
+			multisampled ? colorView : swapchainViews.at(i),
+			depthView
+		};
+		if (multisampled)
+			attachments.push_back(swapchainViews.at(i));
+
 		vk::FramebufferCreateInfo framebufferInfo{
 			vk::FramebufferCreateFlags(),
 			renderPass,
-			1,
-			&swapchainViews.at(i),
+			static_cast<uint32_t>(attachments.size()),
+			attachments.data(),
 			width,
 			height,
 			1
@@ -523,20 +1935,167 @@ void createFramebuffers()
 	}
 }
 
-uint32_t getMemoryIndex(uint32_t filter, vk::MemoryPropertyFlags flags)
+// Preferred flags are given up before the allocation fails, required ones never are
+uint32_t getMemoryIndex(uint32_t filter, vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred)
 {
-	auto memoryProperties = physicalDevice.getMemoryProperties();
+	for (auto flags : { required | preferred, required })
+		for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
+			if ((filter & (1 << i)) && (flags & memoryProperties.memoryTypes[i].propertyFlags) == flags)
+				return i;
 
-	for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++)
-		if ((filter & (1 << i)) && (flags & memoryProperties.memoryTypes[i].propertyFlags) == flags)
-			return i;
+	throw vk::OutOfDeviceMemoryError("No memory type has the required properties");
+}
 
-	return std::numeric_limits<uint32_t>::max();
+const char* getCategoryName(MemoryCategory category)
+{
+	switch (category)
+	{
+	case MemoryCategory::eGeometry:
+		return "geometry";
+	case MemoryCategory::eTextures:
+		return "textures";
+	case MemoryCategory::eUniforms:
+		return "uniforms";
+	case MemoryCategory::eIndirect:
+		return "indirect";
+	case MemoryCategory::eStaging:
+		return "staging";
+	case MemoryCategory::eAttachments:
+		return "attachments";
+	default:
+		return "unknown";
+	}
 }
 
-vk::CommandBuffer beginSingleTimeCommand()
+// Out of memory waits for the oldest retired memory block to be released, then tries once more. Retired
+// resources are destroyed in order, so the wait covers every entry ahead of that block as well. Values of
+// frames not submitted yet would never be signalled, when one comes first nothing can be reclaimed
+vk::DeviceMemory allocateMemory(const vk::MemoryRequirements& requirements, uint32_t typeIndex, MemoryCategory category)
 {
-	vk::CommandBufferAllocateInfo allocationInfo{
+	vk::MemoryAllocateInfo allocationInfo{
+		requirements.size,
+		typeIndex
+	};
+
+	vk::DeviceMemory memory;
+	try {
+		memory = device.allocateMemory(allocationInfo);
+	}
+	catch (const vk::OutOfDeviceMemoryError&) {
+		uint64_t lastUse = 0;
+		bool reclaimable = false;
+		for (auto& resource : retiredResources)
+		{
+			if (resource.frameValue > submittedFrame)
+				break;
+
+			lastUse = std::max(lastUse, resource.frameValue);
+			if (resource.type == vk::ObjectType::eDeviceMemory)
+			{
+				reclaimable = true;
+				break;
+			}
+		}
+		if (!reclaimable)
+			throw;
+
+		waitFrame(lastUse);
+		destroyRetired(false);
+		memory = device.allocateMemory(allocationInfo);
+	}
+
+	auto heapIndex = memoryProperties.memoryTypes[typeIndex].heapIndex;
+	memoryAllocations[getRawHandle(memory)] = MemoryAllocation{
+		heapIndex,
+		category,
+		requirements.size
+	};
+
+	auto& heap = heapBudgets.at(heapIndex);
+	heap.allocated += requirements.size;
+	heap.categories.at(static_cast<size_t>(category)) += requirements.size;
+	heap.peak = std::max(heap.peak, heap.allocated);
+	return memory;
+}
+
+// Above 90% of any device local budget textures drop one more level, below 75% they get one back
+void updateMemoryBudget()
+{
+	if (memoryBudget)
+	{
+		auto properties = physicalDevice.getMemoryProperties2<vk::PhysicalDeviceMemoryProperties2,
+			vk::PhysicalDeviceMemoryBudgetPropertiesEXT>().get<vk::PhysicalDeviceMemoryBudgetPropertiesEXT>();
+		for (uint32_t i = 0; i < heapBudgets.size(); i++)
+		{
+			heapBudgets.at(i).budget = properties.heapBudget[i];
+			heapBudgets.at(i).usage = properties.heapUsage[i];
+		}
+	}
+	else
+		for (auto& heap : heapBudgets)
+			heap.usage = heap.allocated;
+
+	double pressure = 0.0;
+	for (auto& heap : heapBudgets)
+		if (heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal && heap.budget)
+			pressure = std::max(pressure, static_cast<double>(heap.usage) / static_cast<double>(heap.budget));
+
+	if (pressure > 0.9 && textureLevelBias < 4)
+		textureLevelBias++;
+	else if (pressure < 0.75 && textureLevelBias)
+		textureLevelBias--;
+}
+
+// Without the extension other processes are invisible, so only 80% of each heap is assumed to be ours
+void createMemoryBudget()
+{
+	heapBudgets.clear();
+	for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++)
+		heapBudgets.push_back(HeapBudget{
+			memoryProperties.memoryHeaps[i].flags,
+			memoryProperties.memoryHeaps[i].size,
+			memoryProperties.memoryHeaps[i].size / 5 * 4,
+			0,
+			0,
+			0,
+			{}
+		});
+
+	textureLevelBias = 0;
+	memoryUpdate = std::chrono::steady_clock::now();
+	updateMemoryBudget();
+}
+
+void printMemoryReport()
+{
+	for (uint32_t i = 0; i < heapBudgets.size(); i++)
+	{
+		auto& heap = heapBudgets.at(i);
+		std::cout << "Heap " << i << (heap.flags & vk::MemoryHeapFlagBits::eDeviceLocal ? " (device local)" : "")
+			<< ": " << (heap.usage >> 20) << " of " << (heap.budget >> 20) << " MiB budget, ours "
+			<< (heap.allocated >> 10) << " KiB";
+		for (size_t category = 0; category < heap.categories.size(); category++)
+			if (heap.categories.at(category))
+				std::cout << ", " << getCategoryName(static_cast<MemoryCategory>(category)) << ' '
+					<< (heap.categories.at(category) >> 10);
+		std::cout << '\n';
+	}
+	if (textureLevelBias)
+		std::cout << "Memory pressure, textures drop " << textureLevelBias << " levels\n";
+}
+
+UploadBatch& getUpload()
+{
+	if (upload.transferBuffer)
+		return upload;
+
+	vk::CommandBufferAllocateInfo transferAllocation{
+		transferPool,
+		vk::CommandBufferLevel::ePrimary,
+		1
+	};
+
+	vk::CommandBufferAllocateInfo acquireAllocation{
 		commandPool,
 		vk::CommandBufferLevel::ePrimary,
 		1
@@ -546,346 +2105,1422 @@ vk::CommandBuffer beginSingleTimeCommand()
 		vk::CommandBufferUsageFlagBits::eOneTimeSubmit
 	};
 
-	auto commandBuffer = device.allocateCommandBuffers(allocationInfo).at(0);
-	commandBuffer.begin(commandBufferBegin);
-	return commandBuffer;
+	upload.transferBuffer = device.allocateCommandBuffers(transferAllocation).at(0);
+	upload.transferBuffer.begin(commandBufferBegin);
+	// Ownership only has to be acquired when the copies ran on another family
+	if (transferIndex != queueIndex)
+	{
+		upload.acquireBuffer = device.allocateCommandBuffers(acquireAllocation).at(0);
+		upload.acquireBuffer.begin(commandBufferBegin);
+	}
+	return upload;
+}
+
+void submitUpload()
+{
+	if (!upload.transferBuffer)
+		return;
+
+	upload.transferBuffer.end();
+
+	vk::SubmitInfo transferSubmit{
+		0,
+		nullptr,
+		nullptr,
+		1,
+		&upload.transferBuffer,
+		0,
+		nullptr
+	};
+
+	if (!upload.acquireBuffer)
+		static_cast<void>(transferQueue.submit(1, &transferSubmit, nullptr));
+	else
+	{
+		upload.acquireBuffer.end();
+		upload.semaphore = device.createSemaphore(vk::SemaphoreCreateInfo());
+		transferSubmit.setSignalSemaphoreCount(1);
+		transferSubmit.setPSignalSemaphores(&upload.semaphore);
+
+		vk::PipelineStageFlags waitStage = vk::PipelineStageFlagBits::eVertexInput |
+			vk::PipelineStageFlagBits::eFragmentShader;
+
+		vk::SubmitInfo acquireSubmit{
+			1,
+			&upload.semaphore,
+			&waitStage,
+			1,
+			&upload.acquireBuffer,
+			0,
+			nullptr
+		};
+
+		// Frames submitted after the acquire are ordered behind it by its barriers, nothing waits on the CPU
+		static_cast<void>(transferQueue.submit(1, &transferSubmit, nullptr));
+		static_cast<void>(queue.submit(1, &acquireSubmit, nullptr));
+	}
+
+	// Submitted ahead of the next frame on the graphics queue, so that frame completing covers the batch
+	auto lastUse = frameValue + 1;
+	retireResource(upload.transferBuffer, lastUse, transferPool);
+	retireResource(upload.acquireBuffer, lastUse, commandPool);
+	retireResource(upload.semaphore, lastUse);
+	for (auto& staging : upload.stagingBuffers)
+	{
+		retireResource(staging.first, lastUse);
+		retireResource(staging.second, lastUse);
+	}
+	upload = UploadBatch();
+}
+
+void copyBuffer(vk::Buffer& source, vk::Buffer& destination, vk::DeviceSize size)
+{
+	vk::BufferCopy region{
+		0,
+		0,
+		size
+	};
+
+	getUpload().transferBuffer.copyBuffer(source, destination, 1, &region);
+}
+
+// Hands a buffer written by the transfer queue to the stage that reads it on the graphics queue
+void releaseBuffer(vk::Buffer& buffer, vk::PipelineStageFlags stage, vk::AccessFlags access)
+{
+	auto& batch = getUpload();
+	bool transfer = transferIndex != queueIndex;
+
+	vk::BufferMemoryBarrier barrier{
+		vk::AccessFlagBits::eTransferWrite,
+		transfer ? vk::AccessFlags() : access,
+		transfer ? transferIndex : VK_QUEUE_FAMILY_IGNORED,
+		transfer ? queueIndex : VK_QUEUE_FAMILY_IGNORED,
+		buffer,
+		0,
+		VK_WHOLE_SIZE
+	};
+
+	batch.transferBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+		transfer ? vk::PipelineStageFlagBits::eBottomOfPipe : stage, vk::DependencyFlags(), 0, nullptr, 1, &barrier, 0, nullptr);
+	if (!transfer)
+		return;
+
+	barrier.setSrcAccessMask(vk::AccessFlags());
+	barrier.setDstAccessMask(access);
+	batch.acquireBuffer.pipelineBarrier(stage, stage, vk::DependencyFlags(), 0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+// Graphics and compute families when they differ, buffers both read are shared rather than transferred every frame
+std::vector<uint32_t> getSharedFamilies()
+{
+	if (computeIndex == queueIndex)
+		return {};
+
+	return { queueIndex, computeIndex };
+}
+
+void createBuffer(vk::Buffer& buffer, vk::DeviceMemory& memory, vk::DeviceSize size, vk::BufferUsageFlags usage,
+	vk::MemoryPropertyFlags required, vk::MemoryPropertyFlags preferred, MemoryCategory category,
+	const std::vector<uint32_t>& families = {})
+{
+	vk::BufferCreateInfo bufferInfo{
+		vk::BufferCreateFlags(),
+		size,
+		usage,
+		families.empty() ? vk::SharingMode::eExclusive : vk::SharingMode::eConcurrent,
+		static_cast<uint32_t>(families.size()),
+		families.data()
+	};
+
+	buffer = device.createBuffer(bufferInfo);
+	auto requirements = device.getBufferMemoryRequirements(buffer);
+
+	memory = allocateMemory(requirements, getMemoryIndex(requirements.memoryTypeBits, required, preferred), category);
+	device.bindBufferMemory(buffer, memory, 0);
+}
+
+void createImage(vk::Image& image, vk::DeviceMemory& memory, uint32_t imageWidth, uint32_t imageHeight,
+	uint32_t levels, vk::Format format, vk::ImageUsageFlags usage, vk::MemoryPropertyFlags required,
+	vk::MemoryPropertyFlags preferred, MemoryCategory category, vk::SampleCountFlagBits samples = vk::SampleCountFlagBits::e1)
+{
+	vk::ImageCreateInfo imageInfo{
+		vk::ImageCreateFlags(),
+		vk::ImageType::e2D,
+		format,
+		vk::Extent3D{
+			imageWidth,
+			imageHeight,
+			1
+		},
+		levels,
+		1,
+		samples,
+		vk::ImageTiling::eOptimal,
+		usage,
+		vk::SharingMode::eExclusive,
+		0,
+		nullptr,
+		vk::ImageLayout::eUndefined
+	};
+
+	image = device.createImage(imageInfo);
+	auto requirements = device.getImageMemoryRequirements(image);
+
+	memory = allocateMemory(requirements, getMemoryIndex(requirements.memoryTypeBits, required, preferred), category);
+	device.bindImageMemory(image, memory, 0);
+}
+
+void copyBufferToImage(vk::Buffer& source, vk::Image& destination, uint32_t imageWidth, uint32_t imageHeight)
+{
+	auto& batch = getUpload();
+
+	vk::ImageMemoryBarrier barrier{
+		vk::AccessFlags(),
+		vk::AccessFlagBits::eTransferWrite,
+		vk::ImageLayout::eUndefined,
+		vk::ImageLayout::eTransferDstOptimal,
+		VK_QUEUE_FAMILY_IGNORED,
+		VK_QUEUE_FAMILY_IGNORED,
+		destination,
+		vk::ImageSubresourceRange{
+			vk::ImageAspectFlagBits::eColor,
+			0,
+			1,
+			0,
+			1
+		}
+	};
+
+	vk::BufferImageCopy region{
+		0,
+		0,
+		0,
+		vk::ImageSubresourceLayers{
+			vk::ImageAspectFlagBits::eColor,
+			0,
+			0,
+			1
+		},
+		vk::Offset3D{
+			0,
+			0,
+			0
+		},
+		vk::Extent3D{
+			imageWidth,
+			imageHeight,
+			1
+		}
+	};
+
+	batch.transferBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTopOfPipe, vk::PipelineStageFlagBits::eTransfer,
+		vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &barrier);
+	batch.transferBuffer.copyBufferToImage(source, destination, vk::ImageLayout::eTransferDstOptimal, 1, &region);
+}
+
+// Moves a freshly copied image to shader reads, the layout change happens in the release and acquire pair
+void releaseImage(vk::Image& image, vk::PipelineStageFlags stage)
+{
+	auto& batch = getUpload();
+	bool transfer = transferIndex != queueIndex;
+
+	vk::ImageMemoryBarrier barrier{
+		vk::AccessFlagBits::eTransferWrite,
+		transfer ? vk::AccessFlags() : vk::AccessFlagBits::eShaderRead,
+		vk::ImageLayout::eTransferDstOptimal,
+		vk::ImageLayout::eShaderReadOnlyOptimal,
+		transfer ? transferIndex : VK_QUEUE_FAMILY_IGNORED,
+		transfer ? queueIndex : VK_QUEUE_FAMILY_IGNORED,
+		image,
+		vk::ImageSubresourceRange{
+			vk::ImageAspectFlagBits::eColor,
+			0,
+			1,
+			0,
+			1
+		}
+	};
+
+	batch.transferBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eTransfer,
+		transfer ? vk::PipelineStageFlagBits::eBottomOfPipe : stage, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &barrier);
+	if (!transfer)
+		return;
+
+	barrier.setSrcAccessMask(vk::AccessFlags());
+	barrier.setDstAccessMask(vk::AccessFlagBits::eShaderRead);
+	batch.acquireBuffer.pipelineBarrier(stage, stage, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void writeMemory(vk::DeviceMemory memory, const void* source, vk::DeviceSize size)
+{
+	auto data = device.mapMemory(memory, 0, size);
+	std::memcpy(data, source, size);
+	device.unmapMemory(memory);
+}
+
+// The staging buffer lives until the graphics queue has acquired everything in its batch
+vk::Buffer createStagingBuffer(const void* source, vk::DeviceSize size)
+{
+	vk::Buffer stagingBuffer;
+	vk::DeviceMemory stagingMemory;
+
+	createBuffer(stagingBuffer, stagingMemory, size, vk::BufferUsageFlagBits::eTransferSrc,
+		vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+		vk::MemoryPropertyFlags(), MemoryCategory::eStaging);
+	writeMemory(stagingMemory, source, size);
+
+	getUpload().stagingBuffers.emplace_back(stagingBuffer, stagingMemory);
+	return stagingBuffer;
+}
+
+// Depth only has to be stored when dynamic rendering hands it from the pre-pass to shading, otherwise it
+// stays transient and tilers never have to back it with memory. Lazily allocated memory only exists on
+// tilers, everywhere else the image is backed up front
+void createDepthResources()
+{
+	vk::ImageUsageFlags usage = vk::ImageUsageFlagBits::eDepthStencilAttachment;
+	vk::MemoryPropertyFlags preferred;
+	if (!dynamicRendering || !depthPrepass)
+	{
+		usage |= vk::ImageUsageFlagBits::eTransientAttachment;
+		preferred = vk::MemoryPropertyFlagBits::eLazilyAllocated;
+	}
+
+	createImage(depthImage, depthMemory, width, height, 1, depthFormat, usage, vk::MemoryPropertyFlagBits::eDeviceLocal,
+		preferred, MemoryCategory::eAttachments, sampleCount);
+	depthView = createImageView(depthImage, 1, depthFormat, getDepthAspect(depthFormat));
+}
+
+// Multisampled color is resolved within the pass, so it is never stored either
+void createColorResources()
+{
+	if (sampleCount == vk::SampleCountFlagBits::e1)
+		return;
+
+	createImage(colorImage, colorMemory, width, height, 1, swapchainFormat,
+		vk::ImageUsageFlagBits::eColorAttachment | vk::ImageUsageFlagBits::eTransientAttachment,
+		vk::MemoryPropertyFlagBits::eDeviceLocal, vk::MemoryPropertyFlagBits::eLazilyAllocated,
+		MemoryCategory::eAttachments, sampleCount);
+	colorView = createImageView(colorImage, 1, swapchainFormat, vk::ImageAspectFlagBits::eColor);
+}
+
+void createElementBuffers()
+{
+	bakeScene(scene, vertices, indices, [](uint32_t count, const auto& function) {
+		parallelFor(jobs, 0, count, 64, function);
+	});
+
+	// The scene sits under a root so the hierarchy path is exercised even for a single object
+	auto sceneNode = addTransform(hierarchy, rootTransform, glm::mat4(1.0f));
+	drawNode = addTransform(hierarchy, sceneNode, glm::mat4(1.0f));
+
+	glm::vec3 center(0.0f);
+	for (auto& vertex : vertices)
+		center += vertex.pos / static_cast<float>(vertices.size());
+	drawBounds = glm::vec4(center, 0.0f);
+	for (auto& vertex : vertices)
+		drawBounds.w = std::max(drawBounds.w, glm::length(vertex.pos - center));
+
+	auto vertexSize = vertices.size() * sizeof(Vertex);
+	auto indexSize = indices.size() * sizeof(uint32_t);
+
+	// Unified memory is written in place, host writes are visible to the frames submitted after them
+	if (unifiedMemory)
+	{
+		createBuffer(vertexBuffer, vertexMemory, vertexSize, vk::BufferUsageFlagBits::eVertexBuffer,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+			vk::MemoryPropertyFlagBits::eDeviceLocal, MemoryCategory::eGeometry);
+		createBuffer(indexBuffer, indexMemory, indexSize, vk::BufferUsageFlagBits::eIndexBuffer,
+			vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent,
+			vk::MemoryPropertyFlagBits::eDeviceLocal, MemoryCategory::eGeometry);
+		writeMemory(vertexMemory, vertices.data(), vertexSize);
+		writeMemory(indexMemory, indices.data(), indexSize);
+		return;
+	}
+
+	createBuffer(vertexBuffer, vertexMemory, vertexSize, vk::BufferUsageFlagBits::eTransferDst |
+		vk::BufferUsageFlagBits::eVertexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::MemoryPropertyFlags(),
+		MemoryCategory::eGeometry);
+	createBuffer(indexBuffer, indexMemory, indexSize, vk::BufferUsageFlagBits::eTransferDst |
+		vk::BufferUsageFlagBits::eIndexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal, vk::MemoryPropertyFlags(),
+		MemoryCategory::eGeometry);
+
+	auto vertexStaging = createStagingBuffer(vertices.data(), vertexSize);
+	copyBuffer(vertexStaging, vertexBuffer, vertexSize);
+	releaseBuffer(vertexBuffer, vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eVertexAttributeRead);
+
+	auto indexStaging = createStagingBuffer(indices.data(), indexSize);
+	copyBuffer(indexStaging, indexBuffer, indexSize);
+	releaseBuffer(indexBuffer, vk::PipelineStageFlagBits::eVertexInput, vk::AccessFlagBits::eIndexRead);
+}
+
+void createUniformBuffers()
+{
+	uniformBuffers.resize(swapchainImages.size());
+	uniformMemories.resize(swapchainImages.size());
+
+	for (uint32_t i = 0; i < uniformBuffers.size(); i++)
+		createBuffer(uniformBuffers.at(i), uniformMemories.at(i), sizeof(Transformation),
+			vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible |
+			vk::MemoryPropertyFlagBits::eHostCoherent, vk::MemoryPropertyFlagBits::eDeviceLocal,
+			MemoryCategory::eUniforms, getSharedFamilies());
+}
+
+void createIndirectBuffers()
+{
+	indirectBuffers.resize(swapchainImages.size());
+	indirectMemories.resize(swapchainImages.size());
+
+	for (uint32_t i = 0; i < indirectBuffers.size(); i++)
+		createBuffer(indirectBuffers.at(i), indirectMemories.at(i), sizeof(DrawCommand),
+			vk::BufferUsageFlagBits::eStorageBuffer | vk::BufferUsageFlagBits::eIndirectBuffer,
+			vk::MemoryPropertyFlagBits::eDeviceLocal, vk::MemoryPropertyFlags(), MemoryCategory::eIndirect,
+			getSharedFamilies());
+}
+
+void createDescriptors()
+{
+	vk::DescriptorPoolSize uniformSize{
+		vk::DescriptorType::eUniformBuffer,
+		static_cast<uint32_t>(swapchainImages.size())
+	};
+
+	vk::DescriptorPoolCreateInfo descriptorInfo{
+		vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
+		static_cast<uint32_t>(swapchainImages.size()),
+		1,
+		&uniformSize
+	};
+
+	descriptorPool = device.createDescriptorPool(descriptorInfo);
+
+	std::vector<vk::DescriptorSetLayout> layouts{
+		static_cast<uint32_t>(swapchainImages.size()),
+		descriptorSetLayout
+	};
+
+	vk::DescriptorSetAllocateInfo allocationInfo{
+		descriptorPool,
+		static_cast<uint32_t>(layouts.size()),
+		layouts.data()
+	};
+
+	descriptorSets = device.allocateDescriptorSets(allocationInfo);
+
+	for (uint32_t i = 0; i < descriptorSets.size(); i++)
+	{
+		vk::DescriptorBufferInfo bufferInfo{
+			uniformBuffers.at(i),
+			0,
+			sizeof(Transformation)
+		};
+
+		vk::WriteDescriptorSet descriptorWrite{
+			descriptorSets.at(i),
+			0,
+			0,
+			1,
+			vk::DescriptorType::eUniformBuffer,
+			nullptr,
+			&bufferInfo,
+			nullptr
+		};
+
+		device.updateDescriptorSets(1, &descriptorWrite, 0, nullptr);
+	}
+}
+
+void createCullDescriptors()
+{
+	std::array<vk::DescriptorPoolSize, 2> poolSizes{
+		vk::DescriptorPoolSize{
+			vk::DescriptorType::eUniformBuffer,
+			static_cast<uint32_t>(swapchainImages.size())
+		},
+		vk::DescriptorPoolSize{
+			vk::DescriptorType::eStorageBuffer,
+			static_cast<uint32_t>(swapchainImages.size())
+		}
+	};
+
+	vk::DescriptorPoolCreateInfo descriptorInfo{
+		vk::DescriptorPoolCreateFlags(),
+		static_cast<uint32_t>(swapchainImages.size()),
+		static_cast<uint32_t>(poolSizes.size()),
+		poolSizes.data()
+	};
+
+	cullPool = device.createDescriptorPool(descriptorInfo);
+
+	std::vector<vk::DescriptorSetLayout> layouts{
+		static_cast<uint32_t>(swapchainImages.size()),
+		cullSetLayout
+	};
+
+	vk::DescriptorSetAllocateInfo allocationInfo{
+		cullPool,
+		static_cast<uint32_t>(layouts.size()),
+		layouts.data()
+	};
+
+	cullSets = device.allocateDescriptorSets(allocationInfo);
+
+	for (uint32_t i = 0; i < cullSets.size(); i++)
+	{
+		vk::DescriptorBufferInfo uniformInfo{
+			uniformBuffers.at(i),
+			0,
+			sizeof(Transformation)
+		};
+
+		vk::DescriptorBufferInfo indirectInfo{
+			indirectBuffers.at(i),
+			0,
+			sizeof(DrawCommand)
+		};
+
+		std::array<vk::WriteDescriptorSet, 2> descriptorWrites{
+			vk::WriteDescriptorSet{
+				cullSets.at(i),
+				0,
+				0,
+				1,
+				vk::DescriptorType::eUniformBuffer,
+				nullptr,
+				&uniformInfo,
+				nullptr
+			},
+			vk::WriteDescriptorSet{
+				cullSets.at(i),
+				1,
+				0,
+				1,
+				vk::DescriptorType::eStorageBuffer,
+				nullptr,
+				&indirectInfo,
+				nullptr
+			}
+		};
+
+		device.updateDescriptorSets(static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
+}
+
+void createBindlessDescriptors()
+{
+	std::array<vk::DescriptorPoolSize, 2> poolSizes{
+		vk::DescriptorPoolSize{
+			vk::DescriptorType::eStorageBuffer,
+			1
+		},
+		vk::DescriptorPoolSize{
+			vk::DescriptorType::eCombinedImageSampler,
+			textureLimit
+		}
+	};
+
+	vk::DescriptorPoolCreateInfo poolInfo{
+		vk::DescriptorPoolCreateFlagBits::eUpdateAfterBind,
+		1,
+		static_cast<uint32_t>(poolSizes.size()),
+		poolSizes.data()
+	};
+
+	bindlessPool = device.createDescriptorPool(poolInfo);
+
+	vk::DescriptorSetVariableDescriptorCountAllocateInfo countInfo{
+		1,
+		&textureLimit
+	};
+
+	vk::DescriptorSetAllocateInfo allocationInfo{
+		bindlessPool,
+		1,
+		&bindlessSetLayout
+	};
+	allocationInfo.setPNext(&countInfo);
+
+	bindlessSet = device.allocateDescriptorSets(allocationInfo).at(0);
+
+	vk::SamplerCreateInfo samplerInfo{
+		vk::SamplerCreateFlags(),
+		vk::Filter::eLinear,
+		vk::Filter::eLinear,
+		vk::SamplerMipmapMode::eLinear,
+		vk::SamplerAddressMode::eRepeat,
+		vk::SamplerAddressMode::eRepeat,
+		vk::SamplerAddressMode::eRepeat,
+		0.0f,
+		VK_FALSE,
+		1.0f,
+		VK_FALSE,
+		vk::CompareOp::eNever,
+		0.0f,
+		VK_LOD_CLAMP_NONE,
+		vk::BorderColor::eFloatOpaqueBlack,
+		VK_FALSE
+	};
+
+	sampler = device.createSampler(samplerInfo);
+
+	// Materials stay persistently mapped, new entries are appended without touching the descriptor
+	createBuffer(materialBuffer, materialMemory, materialLimit * sizeof(Material),
+		vk::BufferUsageFlagBits::eStorageBuffer, vk::MemoryPropertyFlagBits::eHostVisible |
+		vk::MemoryPropertyFlagBits::eHostCoherent, vk::MemoryPropertyFlagBits::eDeviceLocal, MemoryCategory::eUniforms);
+	materialData = static_cast<Material*>(device.mapMemory(materialMemory, 0, materialLimit * sizeof(Material)));
+	materialCount = 0;
+
+	vk::DescriptorBufferInfo bufferInfo{
+		materialBuffer,
+		0,
+		materialLimit * sizeof(Material)
+	};
+
+	vk::WriteDescriptorSet descriptorWrite{
+		bindlessSet,
+		0,
+		0,
+		1,
+		vk::DescriptorType::eStorageBuffer,
+		nullptr,
+		&bufferInfo,
+		nullptr
+	};
+
+	device.updateDescriptorSets(1, &descriptorWrite, 0, nullptr);
+}
+
+// 2x2 box filter over RGBA8 texels, an odd last row or column is dropped
+std::vector<uint8_t> halveTexture(const uint8_t* pixels, uint32_t textureWidth, uint32_t textureHeight)
+{
+	std::vector<uint8_t> halved((textureWidth / 2) * (textureHeight / 2) * 4);
+	for (uint32_t y = 0; y < textureHeight / 2; y++)
+		for (uint32_t x = 0; x < textureWidth / 2; x++)
+			for (uint32_t channel = 0; channel < 4; channel++)
+			{
+				auto texel = [&](uint32_t column, uint32_t row) {
+					return static_cast<uint32_t>(pixels[(row * textureWidth + column) * 4 + channel]);
+				};
+				halved.at((y * (textureWidth / 2) + x) * 4 + channel) = static_cast<uint8_t>((texel(2 * x, 2 * y) +
+					texel(2 * x + 1, 2 * y) + texel(2 * x, 2 * y + 1) + texel(2 * x + 1, 2 * y + 1) + 2) / 4);
+			}
+
+	return halved;
+}
+
+// Under memory pressure uploads back off to a coarser level, the way a streamer holds back its finest mips
+void createTextureImage(Texture& texture)
+{
+	const uint8_t* pixels = texture.pixels.data();
+	auto textureWidth = texture.width;
+	auto textureHeight = texture.height;
+	std::vector<uint8_t> reduced;
+	for (uint32_t level = 0; level < textureLevelBias && textureWidth > 1 && textureHeight > 1; level++)
+	{
+		reduced = halveTexture(pixels, textureWidth, textureHeight);
+		pixels = reduced.data();
+		textureWidth /= 2;
+		textureHeight /= 2;
+	}
+
+	texture.levelBias = textureLevelBias;
+	auto stagingBuffer = createStagingBuffer(pixels, textureWidth * textureHeight * 4);
+
+	createImage(texture.image, texture.memory, textureWidth, textureHeight, 1, vk::Format::eR8G8B8A8Unorm,
+		vk::ImageUsageFlagBits::eTransferDst | vk::ImageUsageFlagBits::eSampled,
+		vk::MemoryPropertyFlagBits::eDeviceLocal, vk::MemoryPropertyFlags(), MemoryCategory::eTextures);
+	copyBufferToImage(stagingBuffer, texture.image, textureWidth, textureHeight);
+	releaseImage(texture.image, vk::PipelineStageFlagBits::eFragmentShader);
+	texture.view = createImageView(texture.image, 1, vk::Format::eR8G8B8A8Unorm, vk::ImageAspectFlagBits::eColor);
+}
+
+void writeTextureDescriptor(const Texture& texture, uint32_t slot)
+{
+	vk::DescriptorImageInfo imageInfo{
+		sampler,
+		texture.view,
+		vk::ImageLayout::eShaderReadOnlyOptimal
+	};
+
+	// Update after bind lets this slot be written while frames using other slots are in flight
+	vk::WriteDescriptorSet descriptorWrite{
+		bindlessSet,
+		1,
+		slot,
+		1,
+		vk::DescriptorType::eCombinedImageSampler,
+		&imageInfo,
+		nullptr,
+		nullptr
+	};
+
+	device.updateDescriptorSets(1, &descriptorWrite, 0, nullptr);
+}
+
+uint32_t addTexture(const void* pixels, uint32_t textureWidth, uint32_t textureHeight)
+{
+	if (textures.size() >= textureLimit)
+		throw vk::OutOfPoolMemoryError("Bindless texture limit reached");
+
+	auto texels = static_cast<const uint8_t*>(pixels);
+	Texture texture{
+		nullptr,
+		nullptr,
+		nullptr,
+		std::vector<uint8_t>(texels, texels + textureWidth * textureHeight * 4),
+		textureWidth,
+		textureHeight,
+		0
+	};
+
+	createTextureImage(texture);
+	writeTextureDescriptor(texture, static_cast<uint32_t>(textures.size()));
+	textures.push_back(std::move(texture));
+	return static_cast<uint32_t>(textures.size() - 1);
+}
+
+// Rebuilt slots are rewritten in place, which in-flight frames must not see, so submitted frames are drained
+// first. The bias only moves when pressure crosses a threshold, so the stall is rare
+void applyTextureBias()
+{
+	if (std::all_of(textures.begin(), textures.end(), [](const Texture& texture) {
+		return texture.levelBias == textureLevelBias;
+	}))
+		return;
+
+	waitFrame(submittedFrame);
+	for (uint32_t i = 0; i < textures.size(); i++)
+	{
+		auto& texture = textures.at(i);
+		if (texture.levelBias == textureLevelBias)
+			continue;
+
+		retireResource(texture.view);
+		retireResource(texture.image);
+		retireResource(texture.memory);
+		createTextureImage(texture);
+		writeTextureDescriptor(texture, i);
+	}
+}
+
+// Budgets only move when the driver decides, so they are refreshed once a second rather than every frame
+void trackMemory()
+{
+	auto now = std::chrono::steady_clock::now();
+	if (now - memoryUpdate < std::chrono::seconds(1))
+		return;
+
+	memoryUpdate = now;
+	updateMemoryBudget();
+	applyTextureBias();
+	if (reportMemory)
+		printMemoryReport();
+}
+
+uint32_t addMaterial(const Material& material)
+{
+	if (materialCount >= materialLimit)
+		throw vk::OutOfPoolMemoryError("Bindless material limit reached");
+
+	materialData[materialCount] = material;
+	return materialCount++;
+}
+
+void createMaterials()
+{
+	std::array<uint32_t, 64> checker;
+	for (uint32_t i = 0; i < checker.size(); i++)
+		checker.at(i) = ((i / 8 + i % 8) % 2) ? 0xFFFFFFFF : 0xFF808080;
+
+	auto checkerTexture = addTexture(checker.data(), 8, 8);
+	drawMaterial = addMaterial(Material{ glm::vec4(1.0f), checkerTexture });
+}
+
+void createCommandBuffers()
+{
+	vk::CommandBufferAllocateInfo allocationInfo{
+		commandPool,
+		vk::CommandBufferLevel::ePrimary,
+		static_cast<uint32_t>(swapchainImages.size())
+	};
+
+	vk::CommandBufferAllocateInfo computeAllocation{
+		computePool,
+		vk::CommandBufferLevel::ePrimary,
+		static_cast<uint32_t>(swapchainImages.size())
+	};
+
+	commandBuffers = device.allocateCommandBuffers(allocationInfo);
+	computeBuffers = device.allocateCommandBuffers(computeAllocation);
+}
+
+void recordImageBarrier(vk::CommandBuffer& commandBuffer, vk::Image image, vk::ImageAspectFlags aspect,
+	vk::ImageLayout oldLayout, vk::ImageLayout newLayout, vk::PipelineStageFlags sourceStage,
+	vk::AccessFlags sourceAccess, vk::PipelineStageFlags destinationStage, vk::AccessFlags destinationAccess)
+{
+	vk::ImageMemoryBarrier barrier{
+		sourceAccess,
+		destinationAccess,
+		oldLayout,
+		newLayout,
+		VK_QUEUE_FAMILY_IGNORED,
+		VK_QUEUE_FAMILY_IGNORED,
+		image,
+		vk::ImageSubresourceRange{
+			aspect,
+			0,
+			1,
+			0,
+			1
+		}
+	};
+
+	commandBuffer.pipelineBarrier(sourceStage, destinationStage, vk::DependencyFlags(), 0, nullptr, 0, nullptr, 1, &barrier);
 }
 
-void endSingleTimeCommand(vk::CommandBuffer& commandBuffer)
+// Dynamic rendering counterpart of the two subpasses, the pre-pass has no color attachment and stores depth for the main pass
+void beginRendering(vk::CommandBuffer& commandBuffer, uint32_t index, bool prepass)
 {
-	commandBuffer.end();
+	bool multisampled = sampleCount != vk::SampleCountFlagBits::e1;
+
+	vk::RenderingAttachmentInfoKHR colorAttachment{
+		multisampled ? colorView : swapchainViews.at(index),
+		vk::ImageLayout::eColorAttachmentOptimal,
+		multisampled ? vk::ResolveModeFlagBits::eAverage : vk::ResolveModeFlagBits::eNone,
+		multisampled ? swapchainViews.at(index) : vk::ImageView(),
+		multisampled ? vk::ImageLayout::eColorAttachmentOptimal : vk::ImageLayout::eUndefined,
+		vk::AttachmentLoadOp::eClear,
+		multisampled ? vk::AttachmentStoreOp::eDontCare : vk::AttachmentStoreOp::eStore,
+		vk::ClearColorValue{
+			std::array<float, 4>{
+				0.0f,
+				0.0f,
+				0.0f,
+				1.0f
+			}
+		}
+	};
 
-	vk::SubmitInfo submitInfo{
-		0,
-		nullptr,
+	vk::RenderingAttachmentInfoKHR depthAttachment{
+		depthView,
+		vk::ImageLayout::eDepthStencilAttachmentOptimal,
+		vk::ResolveModeFlagBits::eNone,
 		nullptr,
+		vk::ImageLayout::eUndefined,
+		prepass || !depthPrepass ? vk::AttachmentLoadOp::eClear : vk::AttachmentLoadOp::eLoad,
+		prepass ? vk::AttachmentStoreOp::eStore : vk::AttachmentStoreOp::eDontCare,
+		vk::ClearDepthStencilValue{
+			0.0f,
+			0
+		}
+	};
+
+	vk::RenderingInfoKHR renderingInfo{
+		vk::RenderingFlagsKHR(),
+		swapchainArea,
 		1,
-		&commandBuffer,
 		0,
+		prepass ? 0u : 1u,
+		&colorAttachment,
+		&depthAttachment,
 		nullptr
 	};
 
-	static_cast<void>(queue.submit(1, &submitInfo, nullptr));
-	queue.waitIdle();
-	device.freeCommandBuffers(commandPool, 1, &commandBuffer);
+	commandBuffer.beginRenderingKHR(renderingInfo, loader);
 }
 
-void copyBuffer(vk::Buffer& source, vk::Buffer& destination, vk::DeviceSize size)
+void bindPipeline(vk::CommandBuffer& commandBuffer, vk::Pipeline pipeline, const PipelineState& state)
 {
-	auto commandBuffer = beginSingleTimeCommand();
-
-	vk::BufferCopy region{
-		0,
-		0,
-		size
-	};
-
-	commandBuffer.copyBuffer(source, destination, 1, &region);
-	endSingleTimeCommand(commandBuffer);
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
+	if (!extendedDynamicState)
+		return;
+
+	commandBuffer.setPrimitiveTopologyEXT(state.topology, loader);
+	commandBuffer.setCullModeEXT(state.cullMode, loader);
+	commandBuffer.setFrontFaceEXT(state.frontFace, loader);
+	commandBuffer.setDepthWriteEnableEXT(state.depthWrite, loader);
+	commandBuffer.setDepthCompareOpEXT(state.depthCompare, loader);
 }
 
-void createBuffer(vk::Buffer& buffer, vk::DeviceMemory& memory, vk::DeviceSize size,
-	vk::BufferUsageFlags usage, vk::MemoryPropertyFlags properties)
+void beginLabel(vk::CommandBuffer& commandBuffer, const char* name)
 {
-	vk::BufferCreateInfo bufferInfo{
-		vk::BufferCreateFlags(),
-		size,
-		usage,
-		vk::SharingMode::eExclusive,
-		0,
-		nullptr
-	};
-
-	buffer = device.createBuffer(bufferInfo);
-	auto requirements = device.getBufferMemoryRequirements(buffer);
+	if (!debugLabels)
+		return;
 
-	vk::MemoryAllocateInfo allocationInfo{
-		requirements.size,
-		getMemoryIndex(requirements.memoryTypeBits, properties)
+	vk::DebugUtilsLabelEXT label{
+		name,
+		std::array<float, 4>{
+			0.0f,
+			0.0f,
+			0.0f,
+			0.0f
+		}
 	};
 
-	memory = device.allocateMemory(allocationInfo);
-	device.bindBufferMemory(buffer, memory, 0);
+	commandBuffer.beginDebugUtilsLabelEXT(label, loader);
 }
 
-void createElementBuffers()
+void endLabel(vk::CommandBuffer& commandBuffer)
 {
-	vertices.emplace_back(Vertex{ {-0.5f, -0.5f, 0.0f}, {1.0f, 0.0f, 0.0f} });
-	vertices.emplace_back(Vertex{ { 0.5f, -0.5f, 0.0f}, {0.0f, 1.0f, 0.0f} });
-	vertices.emplace_back(Vertex{ {-0.5f,  0.5f, 0.0f}, {0.0f, 0.0f, 1.0f} });
-	vertices.emplace_back(Vertex{ { 0.5f,  0.5f, 0.0f}, {0.0f, 0.0f, 0.0f} });
-
-	indices.emplace_back(0);
-	indices.emplace_back(1);
-	indices.emplace_back(2);
-	indices.emplace_back(1);
-	indices.emplace_back(3);
-	indices.emplace_back(2);
-
-	vk::Buffer stagingBuffer;
-	vk::DeviceMemory stagingMemory;
-	auto vertexSize = vertices.size() * sizeof(Vertex);
-	auto indexSize = indices.size() * sizeof(uint32_t);
-
-	createBuffer(stagingBuffer, stagingMemory, std::max(vertexSize, indexSize), vk::BufferUsageFlagBits::eTransferSrc,
-		vk::MemoryPropertyFlagBits::eHostVisible | vk::MemoryPropertyFlagBits::eHostCoherent);
-	createBuffer(vertexBuffer, vertexMemory, vertexSize, vk::BufferUsageFlagBits::eTransferDst |
-		vk::BufferUsageFlagBits::eVertexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
-	createBuffer(indexBuffer, indexMemory, indexSize, vk::BufferUsageFlagBits::eTransferDst |
-		vk::BufferUsageFlagBits::eIndexBuffer, vk::MemoryPropertyFlagBits::eDeviceLocal);
-
-	auto data = device.mapMemory(stagingMemory, 0, vertexSize);
-	std::memcpy(data, vertices.data(), vertexSize);
-	device.unmapMemory(stagingMemory);
-	copyBuffer(stagingBuffer, vertexBuffer, vertexSize);
+	if (debugLabels)
+		commandBuffer.endDebugUtilsLabelEXT(loader);
+}
 
-	data = device.mapMemory(stagingMemory, 0, indexSize);
-	std::memcpy(data, indices.data(), indexSize);
-	device.unmapMemory(stagingMemory);
-	copyBuffer(stagingBuffer, indexBuffer, indexSize);
+void recordCullCommands(vk::CommandBuffer& commandBuffer, uint32_t index)
+{
+	CullData cullData{
+		objectData,
+		drawBounds,
+		static_cast<uint32_t>(indices.size()),
+		drawMaterial
+	};
 
-	device.destroyBuffer(stagingBuffer, nullptr);
-	device.freeMemory(stagingMemory, nullptr);
+	commandBuffer.bindPipeline(vk::PipelineBindPoint::eCompute, cullPipeline);
+	commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eCompute, cullPipelineLayout,
+		0, 1, &cullSets.at(index), 0, nullptr);
+	commandBuffer.pushConstants(cullPipelineLayout, vk::ShaderStageFlagBits::eCompute,
+		0, cullReflection.pushConstantSize, &cullData);
+	beginLabel(commandBuffer, "Cull");
+	commandBuffer.dispatch(1, 1, 1);
+	endLabel(commandBuffer);
 }
 
-void createUniformBuffers()
+void recordComputeBuffer(uint32_t index)
 {
-	uniformBuffers.resize(swapchainImages.size());
-	uniformMemories.resize(swapchainImages.size());
+	vk::CommandBufferBeginInfo commandBufferBegin{
+		vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+		nullptr
+	};
 
-	for (uint32_t i = 0; i < uniformBuffers.size(); i++)
-		createBuffer(uniformBuffers.at(i), uniformMemories.at(i), sizeof(Transformation),
-			vk::BufferUsageFlagBits::eUniformBuffer, vk::MemoryPropertyFlagBits::eHostVisible |
-			vk::MemoryPropertyFlagBits::eHostCoherent);
+	auto& commandBuffer = computeBuffers.at(index);
+	commandBuffer.begin(commandBufferBegin);
+	recordCullCommands(commandBuffer, index);
+	commandBuffer.end();
 }
 
-void createDescriptors()
+void recordCommandBuffer(uint32_t index)
 {
-	vk::DescriptorPoolSize uniformSize{
-		vk::DescriptorType::eUniformBuffer,
-		static_cast<uint32_t>(swapchainImages.size())
+	vk::CommandBufferBeginInfo commandBufferBegin{
+		vk::CommandBufferUsageFlagBits::eOneTimeSubmit,
+		nullptr
 	};
 
-	vk::DescriptorPoolCreateInfo descriptorInfo{
-		vk::DescriptorPoolCreateFlagBits::eFreeDescriptorSet,
-		static_cast<uint32_t>(swapchainImages.size()),
-		1,
-		&uniformSize
+	std::array<vk::ClearValue, 2> clearValues{
+		vk::ClearColorValue{
+			std::array<float, 4>{
+				0.0f,
+				0.0f,
+				0.0f,
+				1.0f
+			}
+		},
+		vk::ClearDepthStencilValue{
+			0.0f,
+			0
+		}
 	};
 
-	descriptorPool = device.createDescriptorPool(descriptorInfo);
+	vk::RenderPassBeginInfo renderPassBegin{
+		renderPass,
+		dynamicRendering ? vk::Framebuffer() : framebuffers.at(index),
+		swapchainArea,
+		static_cast<uint32_t>(clearValues.size()),
+		clearValues.data()
+	};
 
-	std::vector<vk::DescriptorSetLayout> layouts{
-		static_cast<uint32_t>(swapchainImages.size()),
-		descriptorSetLayout
+	std::array<vk::DescriptorSet, 2> sets{
+		descriptorSets.at(index),
+		bindlessSet
 	};
 
-	vk::DescriptorSetAllocateInfo allocationInfo{
-		descriptorPool,
-		static_cast<uint32_t>(layouts.size()),
-		layouts.data()
+	vk::Viewport viewport{
+		0.0f,
+		0.0f,
+		static_cast<float>(swapchainArea.extent.width),
+		static_cast<float>(swapchainArea.extent.height),
+		0.0f,
+		1.0f
 	};
 
-	descriptorSets = device.allocateDescriptorSets(allocationInfo);
+	// Pipelines still compiling are swapped for the fallback, the main pass cannot use equal depth tests
+	// against a pre-pass that was skipped
+	auto prepassPipeline = depthPrepass ? requestPipeline(prepassState, false) : vk::Pipeline();
+	auto pipeline = requestPipeline(mainState, false);
+	bool ready = pipeline && (!depthPrepass || prepassPipeline);
+	auto& pipelineState = ready ? mainState : fallbackState;
+	if (!ready)
+		pipeline = requestPipeline(fallbackState, false);
 
-	for (uint32_t i = 0; i < descriptorSets.size(); i++)
+	vk::DeviceSize offset = 0;
+	auto& commandBuffer = commandBuffers.at(index);
+
+	commandBuffer.begin(commandBufferBegin);
+	commandBuffer.bindVertexBuffers(0, 1, &vertexBuffer, &offset);
+	commandBuffer.bindIndexBuffer(indexBuffer, offset, vk::IndexType::eUint32);
+	// Material index travels as firstInstance, every draw shares this single bind
+	commandBuffer.bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout,
+		0, static_cast<uint32_t>(sets.size()), sets.data(), 0, nullptr);
+	if (pushConstants)
+		commandBuffer.pushConstants(pipelineLayout, vk::ShaderStageFlagBits::eVertex,
+			0, sizeof(ObjectData), &objectData);
+	if (dynamicViewport)
 	{
-		vk::DescriptorBufferInfo bufferInfo{
-			uniformBuffers.at(i),
-			0,
-			sizeof(Transformation)
-		};
+		commandBuffer.setViewport(0, 1, &viewport);
+		commandBuffer.setScissor(0, 1, &swapchainArea);
+	}
 
-		vk::WriteDescriptorSet descriptorWrite{
-			descriptorSets.at(i),
-			0,
-			0,
-			1,
-			vk::DescriptorType::eUniformBuffer,
-			nullptr,
-			&bufferInfo,
-			nullptr
+	// Inline culling runs ahead of the pass on this queue, async culling was submitted on the compute queue
+	if (!asyncCompute)
+	{
+		vk::MemoryBarrier barrier{
+			vk::AccessFlagBits::eShaderWrite,
+			vk::AccessFlagBits::eIndirectCommandRead
 		};
 
-		device.updateDescriptorSets(1, &descriptorWrite, 0, nullptr);
+		recordCullCommands(commandBuffer, index);
+		commandBuffer.pipelineBarrier(vk::PipelineStageFlagBits::eComputeShader, vk::PipelineStageFlagBits::eDrawIndirect,
+			vk::DependencyFlags(), 1, &barrier, 0, nullptr, 0, nullptr);
 	}
-}
-
-void createCommandBuffers()
-{
-	vk::CommandBufferAllocateInfo allocationInfo{
-		commandPool,
-		vk::CommandBufferLevel::ePrimary,
-		static_cast<uint32_t>(framebuffers.size())
-	};
-
-	commandBuffers = device.allocateCommandBuffers(allocationInfo);
 
-	for (uint32_t i = 0; i < commandBuffers.size(); i++)
+	if (dynamicRendering)
 	{
-		vk::CommandBufferBeginInfo commandBufferBegin{
-			vk::CommandBufferUsageFlagBits::eSimultaneousUse,
-			nullptr
-		};
-
-		vk::ClearValue clearColor{
-			vk::ClearColorValue{
-				std::array<float, 4>{
-					0.0f,
-					0.0f,
-					0.0f,
-					1.0f
-				}
-			}
-		};
+		recordImageBarrier(commandBuffer, swapchainImages.at(index), vk::ImageAspectFlagBits::eColor,
+			vk::ImageLayout::eUndefined, vk::ImageLayout::eColorAttachmentOptimal,
+			vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::AccessFlags(),
+			vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::AccessFlagBits::eColorAttachmentWrite);
+		if (colorImage)
+			recordImageBarrier(commandBuffer, colorImage, vk::ImageAspectFlagBits::eColor,
+				vk::ImageLayout::eUndefined, vk::ImageLayout::eColorAttachmentOptimal,
+				vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::AccessFlagBits::eColorAttachmentWrite,
+				vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::AccessFlagBits::eColorAttachmentWrite);
+		recordImageBarrier(commandBuffer, depthImage, getDepthAspect(depthFormat),
+			vk::ImageLayout::eUndefined, vk::ImageLayout::eDepthStencilAttachmentOptimal,
+			vk::PipelineStageFlagBits::eLateFragmentTests, vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+			vk::PipelineStageFlagBits::eEarlyFragmentTests, vk::AccessFlagBits::eDepthStencilAttachmentRead |
+			vk::AccessFlagBits::eDepthStencilAttachmentWrite);
+	}
+	else
+		commandBuffer.beginRenderPass(renderPassBegin, vk::SubpassContents::eInline);
 
-		vk::RenderPassBeginInfo renderPassBegin{
-			renderPass,
-			framebuffers.at(i),
-			swapchainArea,
-			1,
-			&clearColor
-		};
+	if (depthPrepass)
+	{
+		if (dynamicRendering)
+			beginRendering(commandBuffer, index, true);
+		if (prepassPipeline)
+		{
+			beginLabel(commandBuffer, "Depth pre-pass");
+			bindPipeline(commandBuffer, prepassPipeline, prepassState);
+			commandBuffer.drawIndexedIndirect(indirectBuffers.at(index), 0, 1, sizeof(DrawCommand));
+			endLabel(commandBuffer);
+		}
+		if (dynamicRendering)
+		{
+			commandBuffer.endRenderingKHR(loader);
+			recordImageBarrier(commandBuffer, depthImage, getDepthAspect(depthFormat),
+				vk::ImageLayout::eDepthStencilAttachmentOptimal, vk::ImageLayout::eDepthStencilAttachmentOptimal,
+				vk::PipelineStageFlagBits::eLateFragmentTests, vk::AccessFlagBits::eDepthStencilAttachmentWrite,
+				vk::PipelineStageFlagBits::eEarlyFragmentTests, vk::AccessFlagBits::eDepthStencilAttachmentRead |
+				vk::AccessFlagBits::eDepthStencilAttachmentWrite);
+		}
+		else
+			commandBuffer.nextSubpass(vk::SubpassContents::eInline);
+	}
 
-		vk::DeviceSize offset = 0;
+	if (dynamicRendering)
+		beginRendering(commandBuffer, index, false);
+	beginLabel(commandBuffer, "Shading");
+	bindPipeline(commandBuffer, pipeline, pipelineState);
+	commandBuffer.drawIndexedIndirect(indirectBuffers.at(index), 0, 1, sizeof(DrawCommand));
+	endLabel(commandBuffer);
 
-		commandBuffers.at(i).begin(commandBufferBegin);
-		commandBuffers.at(i).beginRenderPass(renderPassBegin, vk::SubpassContents::eInline);
-		commandBuffers.at(i).bindPipeline(vk::PipelineBindPoint::eGraphics, pipeline);
-		commandBuffers.at(i).bindVertexBuffers(0, 1, &vertexBuffer, &offset);
-		commandBuffers.at(i).bindIndexBuffer(indexBuffer, offset, vk::IndexType::eUint32);
-		commandBuffers.at(i).bindDescriptorSets(vk::PipelineBindPoint::eGraphics, pipelineLayout,
-			0, 1, descriptorSets.data(), 0, nullptr);
-		commandBuffers.at(i).drawIndexed(indices.size(), 1, 0, 0, 0);
-		commandBuffers.at(i).endRenderPass();
-		commandBuffers.at(i).end();
+	if (dynamicRendering)
+	{
+		commandBuffer.endRenderingKHR(loader);
+		recordImageBarrier(commandBuffer, swapchainImages.at(index), vk::ImageAspectFlagBits::eColor,
+			vk::ImageLayout::eColorAttachmentOptimal, vk::ImageLayout::ePresentSrcKHR,
+			vk::PipelineStageFlagBits::eColorAttachmentOutput, vk::AccessFlagBits::eColorAttachmentWrite,
+			vk::PipelineStageFlagBits::eBottomOfPipe, vk::AccessFlags());
 	}
+	else
+		commandBuffer.endRenderPass();
+	commandBuffer.end();
 }
 
 void createSyncObject()
 {
-	syncLimit = 2;
-	frameFences.resize(syncLimit);
+	// Two frames in flight let recording, async culling and the update thread overlap the GPU. Asking for
+	// latency trades that for a single frame, so the CPU never runs ahead, throughput allows one more
+	syncLimit = presentPolicy == PresentPolicy::eLowLatency ? 1 : presentPolicy == PresentPolicy::eThroughput ? 3 : 2;
+	if (scene.settings.framesInFlight)
+		syncLimit = scene.settings.framesInFlight;
 	imageSemaphores.resize(syncLimit);
 	renderSemaphores.resize(syncLimit);
 
-	vk::FenceCreateInfo fenceInfo{
-		vk::FenceCreateFlagBits::eSignaled
+	vk::SemaphoreCreateInfo semaphoreInfo{
+		vk::SemaphoreCreateFlags()
 	};
 
-	vk::SemaphoreCreateInfo semaphoreInfo{
+	vk::SemaphoreTypeCreateInfo timelineInfo{
+		vk::SemaphoreType::eTimeline,
+		0
+	};
+
+	vk::SemaphoreCreateInfo timelineSemaphoreInfo{
 		vk::SemaphoreCreateFlags()
 	};
+	timelineSemaphoreInfo.setPNext(&timelineInfo);
+
+	frameSemaphore = device.createSemaphore(timelineSemaphoreInfo);
+	computeSemaphore = device.createSemaphore(timelineSemaphoreInfo);
+	frameValue = 0;
+	submittedFrame = 0;
+	completedFrame = 0;
+	computeValue = 0;
 
 	for (uint32_t i = 0; i < syncLimit; i++)
 	{
-		frameFences.at(i) = device.createFence(fenceInfo);
 		imageSemaphores.at(i) = device.createSemaphore(semaphoreInfo);
 		renderSemaphores.at(i) = device.createSemaphore(semaphoreInfo);
 	}
 }
 
+// Everything sized by the swapchain is retired with the last submitted frame rather than destroyed behind a device wait
 void cleanupSwapchain()
 {
-	device.freeCommandBuffers(commandPool, commandBuffers.size(), commandBuffers.data());
-	device.freeDescriptorSets(descriptorPool, descriptorSets.size(), descriptorSets.data());
-	device.destroyDescriptorPool(descriptorPool, nullptr);
-	for (uint32_t i = 0; i < uniformBuffers.size(); i++)
-	{
-		device.destroyBuffer(uniformBuffers.at(i), nullptr);
-		device.freeMemory(uniformMemories.at(i), nullptr);
-	}
-	for (auto& framebuffer : framebuffers)
-		device.destroyFramebuffer(framebuffer, nullptr);
-	device.destroyPipeline(pipeline, nullptr);
-	device.destroyPipelineLayout(pipelineLayout, nullptr);
-	device.destroyRenderPass(renderPass, nullptr);
-	for (auto& swapchainView : swapchainViews)
-		device.destroyImageView(swapchainView, nullptr);
-	device.destroySwapchainKHR(swapchain, nullptr);
+	retireResources(commandBuffers, frameValue, commandPool);
+	retireResources(computeBuffers, frameValue, computePool);
+	retireResource(cullPool);
+	retireResources(indirectBuffers);
+	retireResources(indirectMemories);
+	retireResource(descriptorPool);
+	retireResources(uniformBuffers);
+	retireResources(uniformMemories);
+	retireResources(framebuffers);
+	retireResource(depthView);
+	retireResource(depthImage);
+	retireResource(depthMemory);
+	retireResource(colorView);
+	retireResource(colorImage);
+	retireResource(colorMemory);
+	retireResources(swapchainViews);
+	retireResource(swapchain);
 }
 
 void recreateSwapchain()
 {
-	device.waitIdle();
 	cleanupSwapchain();
 	createSwapchain();
-	createRenderPass();
-	createGraphicsPipeline();
+	// The render pass only depends on formats, pipelines only when the extent is baked into them
+	if (!dynamicViewport)
+	{
+		retireAllPipelines();
+		createGraphicsPipeline();
+	}
+	createDepthResources();
+	createColorResources();
 	createFramebuffers();
 	createUniformBuffers();
+	createIndirectBuffers();
 	createDescriptors();
+	createCullDescriptors();
 	createCommandBuffers();
 }
 
 void setup()
 {
 	initializeBase();
+	createMemoryBudget();
 	createSwapchain();
+	chooseDepthFormat();
+	chooseSampleCount();
 	createRenderPass();
 	createShaderModules();
 	createDescriptorSetLayout();
+	createPipelineLayout();
+	createPipelineCache();
+	createComputePipeline();
 	createGraphicsPipeline();
+	createDepthResources();
+	createColorResources();
 	createFramebuffers();
 	createElementBuffers();
+	createBindlessDescriptors();
+	createMaterials();
 	createUniformBuffers();
+	createIndirectBuffers();
 	createDescriptors();
+	createCullDescriptors();
 	createCommandBuffers();
 	createSyncObject();
 }
 
+void reportMemoryPeak()
+{
+	std::cout << "Memory peak:";
+	for (uint32_t i = 0; i < heapBudgets.size(); i++)
+		std::cout << (i ? ", heap " : " heap ") << i << ' ' << (heapBudgets.at(i).peak >> 10) << " KiB";
+	std::cout << std::endl;
+}
+
+void reportJobs()
+{
+	stopJobSystem(jobs);
+	std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - jobs.startTime;
+
+	// Workers come first, then the main and update threads
+	for (uint32_t i = 0; i < jobs.stats.size(); i++)
+	{
+		auto& stats = jobs.stats.at(i);
+		std::chrono::duration<double> busy = stats.busy;
+		std::cout << (i < jobs.workerCount ? "Job worker " + std::to_string(i) :
+			std::string(i == jobs.workerCount ? "Main thread" : "Update thread")) << ": "
+			<< stats.jobs << " jobs, " << stats.steals << " stolen, " << 100.0 * busy.count() / elapsed.count() << "% busy\n";
+	}
+}
+
 void clean()
 {
+	submitUpload();
+	device.waitIdle();
 	cleanupSwapchain();
+	retireAllPipelines();
+	destroyRetired(true);
+	device.destroyRenderPass(renderPass, nullptr);
 	for (uint32_t i = 0; i < syncLimit; i++)
 	{
 		device.destroySemaphore(renderSemaphores.at(i), nullptr);
 		device.destroySemaphore(imageSemaphores.at(i), nullptr);
-		device.destroyFence(frameFences.at(i), nullptr);
 	}
+	device.destroySemaphore(computeSemaphore, nullptr);
+	device.destroySemaphore(frameSemaphore, nullptr);
+	for (auto& texture : textures)
+	{
+		device.destroyImageView(texture.view, nullptr);
+		device.destroyImage(texture.image, nullptr);
+		freeMemory(texture.memory);
+	}
+	device.unmapMemory(materialMemory);
+	device.destroyBuffer(materialBuffer, nullptr);
+	freeMemory(materialMemory);
+	device.destroySampler(sampler, nullptr);
+	device.destroyDescriptorPool(bindlessPool, nullptr);
+	if (hotReload)
+		stopShaderWatcher(shaderCompiler);
+	device.destroyPipeline(cullPipeline, nullptr);
+	destroyPipelineCache();
+	std::cout << "Pipeline registry: " << pipelineCompiles << " compiles, " << pipelineFailures << " failed, "
+		<< pipelineLookups << " lookups" << std::endl;
+	reportMemoryPeak();
+	reportJobs();
+	for (auto& cachedLayout : pipelineLayoutCache)
+		device.destroyPipelineLayout(cachedLayout.second, nullptr);
+	device.destroyShaderModule(cullShader, nullptr);
 	device.destroyShaderModule(fragmentShader, nullptr);
 	device.destroyShaderModule(vertexShader, nullptr);
 	device.destroyBuffer(indexBuffer, nullptr);
-	device.freeMemory(indexMemory, nullptr);
+	freeMemory(indexMemory);
 	device.destroyBuffer(vertexBuffer, nullptr);
-	device.freeMemory(vertexMemory, nullptr);
-	device.destroyDescriptorSetLayout(descriptorSetLayout, nullptr);
+	freeMemory(vertexMemory);
+	for (auto& cachedLayout : setLayoutCache)
+		device.destroyDescriptorSetLayout(cachedLayout.second, nullptr);
+	device.destroyCommandPool(computePool, nullptr);
+	device.destroyCommandPool(transferPool, nullptr);
 	device.destroyCommandPool(commandPool, nullptr);
 	device.destroy(nullptr);
 	instance.destroySurfaceKHR(surface, nullptr);
-	instance.destroyDebugUtilsMessengerEXT(messenger, nullptr, loader);
+	if (messenger)
+		instance.destroyDebugUtilsMessengerEXT(messenger, nullptr, loader);
 	instance.destroy(nullptr);
 	glfwDestroyWindow(window);
 	glfwTerminate();
 }
 
-void updateUniformBuffer(uint32_t index)
+ObjectData packTransform(const glm::mat4& matrix)
+{
+	return ObjectData{
+		{
+			glm::vec4(matrix[0][0], matrix[1][0], matrix[2][0], matrix[3][0]),
+			glm::vec4(matrix[0][1], matrix[1][1], matrix[2][1], matrix[3][1]),
+			glm::vec4(matrix[0][2], matrix[1][2], matrix[2][2], matrix[3][2])
+		}
+	};
+}
+
+// The nodes within one level are split across workers
+void updateHierarchy()
+{
+	updateTransforms(hierarchy, [](uint32_t begin, uint32_t end, const auto& function) {
+		parallelFor(jobs, begin, end, 1024, function);
+	});
+}
+
+// Owns the hierarchy once drawing starts, the swapchain extent is left to the render side
+void updateScene(FrameSnapshot& snapshot)
+{
+	snapshot.sampleTime = std::chrono::steady_clock::now();
+	float time = std::chrono::duration<float, std::chrono::seconds::period>(snapshot.sampleTime - animationStart).count();
+
+	setTransform(hierarchy, drawNode, glm::rotate(glm::mat4(1.0f), time * glm::radians(scene.spin), glm::vec3(0.0f, 0.0f, -1.0f)));
+	updateHierarchy();
+	snapshot.object = packTransform(getTransform(hierarchy, drawNode));
+	snapshot.view = getCameraView(scene, time);
+}
+
+// A failed update closes the hand-off early, the render thread rethrows the error once it finds it closed
+void runUpdates()
+{
+	setJobCaller(jobs, 1);
+	try {
+		while (auto snapshot = beginWrite(snapshots))
+		{
+			updateScene(*snapshot);
+			endWrite(snapshots);
+		}
+	}
+	catch (...) {
+		updateError = std::current_exception();
+		closeHandoff(snapshots);
+	}
+}
+
+void updateUniformBuffer(uint32_t index, const FrameSnapshot& snapshot)
 {
-	static auto startTime = std::chrono::high_resolution_clock::now();
-	auto currentTime = std::chrono::high_resolution_clock::now();
-	float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
+	objectData = snapshot.object;
+
+	// Near and far swapped for reverse-Z, spreads float precision evenly over the view distance
+	auto projection = glm::perspective(glm::radians(scene.fieldOfView), width / (float)height, scene.farPlane, scene.nearPlane);
+	projection[1][1] *= -1;
 
 	Transformation transformation{
-		glm::rotate(glm::mat4(1.0f), time * glm::radians(90.0f), glm::vec3(0.0f, 0.0f, -1.0f)),
-		glm::lookAt(glm::vec3(-2.0f, -2.0f, -2.0f), glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f)),
-		glm::perspective(glm::radians(45.0f), width / (float)height, 0.1f, 10.0f)
+		projection * snapshot.view,
+		objectData
 	};
-	transformation.projection[1][1] *= -1;
 
-	auto data = device.mapMemory(uniformMemories.at(index), 0, sizeof(Transformation));
-	std::memcpy(data, &transformation, sizeof(Transformation));
+	// Object data only rides along in the uniform buffer when push constants are not used
+	auto size = pushConstants ? offsetof(Transformation, object) : sizeof(Transformation);
+	auto data = device.mapMemory(uniformMemories.at(index), 0, size);
+	std::memcpy(data, &transformation, size);
 	device.unmapMemory(uniformMemories.at(index));
 }
 
+void reloadShaders()
+{
+	auto updates = takeShaderUpdates(shaderCompiler);
+	if (updates.empty())
+		return;
+
+	for (auto& update : updates)
+	{
+		bool vertex = update.first == vertexVariant;
+		auto reflection = reflectShader(update.second.data(), update.second.size() * sizeof(uint32_t));
+
+		// Layouts are shared with descriptor sets that are already written, a changed interface needs a restart
+		ShaderReflection reloaded;
+		try {
+			mergeReflection(reloaded, vertex ? reflection : vertexReflection);
+			mergeReflection(reloaded, vertex ? fragmentReflection : reflection);
+		}
+		catch (const std::runtime_error&) {
+			reloaded = ShaderReflection();
+		}
+		if (!isSameInterface(reflectPipeline(), reloaded))
+		{
+			std::cerr << "Shader reload skipped, " << (vertex ? "vertex" : "fragment")
+				<< " shader changed its descriptor bindings or push constants\n";
+			continue;
+		}
+
+		auto& shader = vertex ? vertexShader : fragmentShader;
+		retirePipelines(shader);
+		device.destroyShaderModule(shader, nullptr);
+		shader = createShaderModule(update.second);
+		auto& current = vertex ? vertexReflection : fragmentReflection;
+		current = std::move(reflection);
+	}
+
+	createGraphicsPipeline();
+}
+
+// Sleep granularity is around a millisecond, so the last stretch before the deadline is spun
+void paceFrame()
+{
+	constexpr std::chrono::microseconds spinTime(2000);
+
+	if (frameInterval == std::chrono::steady_clock::duration::zero())
+		return;
+
+	auto now = std::chrono::steady_clock::now();
+	if (now + spinTime < frameDeadline)
+		std::this_thread::sleep_for(frameDeadline - spinTime - now);
+	while (std::chrono::steady_clock::now() < frameDeadline)
+		std::this_thread::yield();
+
+	// Deadlines advance by whole intervals to hold the average rate, a frame late by more than one restarts them
+	now = std::chrono::steady_clock::now();
+	frameDeadline = now - frameDeadline > frameInterval ? now + frameInterval : frameDeadline + frameInterval;
+}
+
+// Input is the moment a frame's state was sampled, completion is when the frame timeline is seen passing it.
+// Presentation itself is only known to the CPU as the return from queuing it
+void collectLatency()
+{
+	auto now = std::chrono::steady_clock::now();
+	while (!frameTimings.empty() && isFrameComplete(frameTimings.front().frameValue))
+	{
+		auto& timing = frameTimings.front();
+		presentLatency += timing.present - timing.input;
+		completeLatency += now - timing.input;
+		latencySamples++;
+		frameTimings.pop_front();
+	}
+
+	if (now - latencyStart < std::chrono::seconds(1) || !latencySamples)
+		return;
+
+	std::chrono::duration<double, std::milli> elapsed = now - latencyStart;
+	std::cout << "Frame " << elapsed.count() / latencySamples << " ms, input to present "
+		<< presentLatency.count() / latencySamples << " ms, input to GPU done "
+		<< completeLatency.count() / latencySamples << " ms\n";
+
+	latencyStart = now;
+	presentLatency = completeLatency = std::chrono::duration<double, std::milli>::zero();
+	latencySamples = 0;
+}
+
 void draw()
 {
 	uint32_t imageIndex, syncIndex = 0;
+	frameDeadline = latencyStart = animationStart = std::chrono::steady_clock::now();
+
+	// Frame n + 1 is simulated while frame n is recorded and submitted, the two stages cost the longer of
+	// them instead of their sum
+	if (threadedUpdate)
+	{
+		openHandoff(snapshots);
+		updateThread = std::thread(runUpdates);
+	}
 
-	while (!glfwWindowShouldClose(window))
+	// A frame limit makes runs bounded for benchmarking and profile training
+	while (!glfwWindowShouldClose(window) && (!frameLimit || frameValue < frameLimit))
 	{
+		// At most syncLimit frames in flight, the semaphores of this slot were last used syncLimit frames ago
+		if (frameValue >= syncLimit)
+			waitFrame(frameValue + 1 - syncLimit);
+		if (reportLatency)
+			collectLatency();
+
+		// Events are polled after every wait so resizes and closes are seen before acquiring
+		paceFrame();
 		glfwPollEvents();
 
-		static_cast<void>(device.waitForFences(1, &frameFences.at(syncIndex), VK_TRUE, std::numeric_limits<uint64_t>::max()));
+		if (hotReload)
+			reloadShaders();
+		// Textures rebuilt for a new budget are uploaded with this frame's batch
+		trackMemory();
+		// Uploads queued since the last frame are handed over ahead of this frame's submission
+		submitUpload();
+		destroyRetired(false);
+
 		auto acquireResult = device.acquireNextImageKHR(swapchain, std::numeric_limits<uint64_t>::max(),
 			imageSemaphores.at(syncIndex), nullptr);
 
@@ -897,21 +3532,103 @@ void draw()
 		}
 
 		imageIndex = acquireResult.value;
-		updateUniformBuffer(imageIndex);
 
-		vk::PipelineStageFlags waitStages[]{
-			vk::PipelineStageFlagBits::eColorAttachmentOutput
+		// Command buffers are recorded per image, make sure the last frame using this one has retired
+		waitFrame(imageValues.at(imageIndex));
+		imageValues.at(imageIndex) = ++frameValue;
+
+		FrameSnapshot snapshot;
+		if (threadedUpdate)
+		{
+			auto published = beginRead(snapshots);
+			if (!published)
+			{
+				updateThread.join();
+				std::rethrow_exception(updateError);
+			}
+			snapshot = *published;
+			endRead(snapshots);
+		}
+		else
+			updateScene(snapshot);
+		updateUniformBuffer(imageIndex, snapshot);
+
+		// The two buffers come from different pools, so they can be recorded side by side
+		JobGroup recording;
+		if (asyncCompute)
+			runJob(jobs, recording, [imageIndex]() { recordComputeBuffer(imageIndex); });
+		recordCommandBuffer(imageIndex);
+		waitJobs(jobs, recording);
+
+		// Culling for this frame overlaps whatever the graphics queue still has in flight, drawing waits
+		// on its timeline value only where the indirect arguments are read
+		if (asyncCompute)
+		{
+			computeValue++;
+
+			vk::TimelineSemaphoreSubmitInfo computeTimeline{
+				0,
+				nullptr,
+				1,
+				&computeValue
+			};
+
+			vk::SubmitInfo computeSubmit{
+				0,
+				nullptr,
+				nullptr,
+				1,
+				&computeBuffers.at(imageIndex),
+				1,
+				&computeSemaphore
+			};
+			computeSubmit.setPNext(&computeTimeline);
+
+			static_cast<void>(computeQueue.submit(1, &computeSubmit, nullptr));
+		}
+
+		std::array<vk::Semaphore, 2> waitSemaphores{
+			imageSemaphores.at(syncIndex),
+			computeSemaphore
+		};
+
+		std::array<vk::PipelineStageFlags, 2> waitStages{
+			vk::PipelineStageFlagBits::eColorAttachmentOutput,
+			vk::PipelineStageFlagBits::eDrawIndirect
+		};
+
+		std::array<uint64_t, 2> waitValues{
+			0,
+			computeValue
+		};
+
+		std::array<vk::Semaphore, 2> signalSemaphores{
+			renderSemaphores.at(syncIndex),
+			frameSemaphore
+		};
+
+		std::array<uint64_t, 2> signalValues{
+			0,
+			frameValue
+		};
+
+		vk::TimelineSemaphoreSubmitInfo timelineInfo{
+			asyncCompute ? 2u : 1u,
+			waitValues.data(),
+			static_cast<uint32_t>(signalValues.size()),
+			signalValues.data()
 		};
 
 		vk::SubmitInfo submitInfo{
-			1,
-			&imageSemaphores.at(syncIndex),
-			waitStages,
+			asyncCompute ? 2u : 1u,
+			waitSemaphores.data(),
+			waitStages.data(),
 			1,
 			&commandBuffers.at(imageIndex),
-			1,
-			&renderSemaphores.at(syncIndex)
+			static_cast<uint32_t>(signalSemaphores.size()),
+			signalSemaphores.data()
 		};
+		submitInfo.setPNext(&timelineInfo);
 
 		vk::PresentInfoKHR presentInfo{
 			1,
@@ -922,8 +3639,8 @@ void draw()
 			nullptr
 		};
 
-		static_cast<void>(device.resetFences(1, &frameFences.at(syncIndex)));
-		static_cast<void>(queue.submit(1, &submitInfo, frameFences.at(syncIndex)));
+		static_cast<void>(queue.submit(1, &submitInfo, nullptr));
+		submittedFrame = frameValue;
 
 		try {
 			static_cast<void>(queue.presentKHR(presentInfo));
@@ -932,15 +3649,20 @@ void draw()
 			recreateSwapchain();
 		}
 
+		if (reportLatency)
+			frameTimings.push_back(FrameTiming{
+				frameValue,
+				snapshot.sampleTime,
+				std::chrono::steady_clock::now()
+			});
+
 		syncIndex = ++syncIndex % syncLimit;
 	}
 
+	if (threadedUpdate)
+	{
+		closeHandoff(snapshots);
+		updateThread.join();
+	}
 	device.waitIdle();
 }
-
-int main()
-{
-	setup();
-	draw();
-	clean();
-}
@@ -0,0 +1,8 @@
+#include "renderer.hpp"
+
+int main()
+{
+	setup();
+	draw();
+	clean();
+}